@@ -0,0 +1,280 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Drives StreamReader the way libVLC's imem access does, by calling its static
+ * callbacks from a separate thread, while a synthetic AbstractMediaStream
+ * produces data on the main thread. libVLC itself is not involved.
+ *
+ * Usage: phonon_vlc_streambenchmark [stream size in MiB]
+ */
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QEventLoop>
+#include <QtCore/QThread>
+#include <QtCore/QVector>
+#include <QtCore/QtAlgorithms>
+
+#include <phonon/abstractmediastream.h>
+#include <phonon/mediasource.h>
+
+#include <stdio.h>
+
+#include "streamreader.h"
+
+using namespace Phonon::VLC;
+
+// Content of the synthetic stream, cheap to produce and to verify.
+static inline char patternAt(quint64 pos)
+{
+    return static_cast<char>((pos * 31) >> 3);
+}
+
+enum SeekPattern {
+    Sequential,
+    /// Skips ahead a little every few reads, like demuxers skipping over junk.
+    ShortForward,
+    /// Jumps back and forth across the whole stream.
+    Random
+};
+
+static const char *seekPatternName(SeekPattern pattern)
+{
+    switch (pattern) {
+    case Sequential:
+        return "sequential";
+    case ShortForward:
+        return "short-forward";
+    case Random:
+        return "random";
+    }
+    return "?";
+}
+
+/// Pull producer writing chunks of a fixed size whenever it is asked for data.
+class SyntheticStream : public Phonon::AbstractMediaStream
+{
+public:
+    SyntheticStream(qint64 size, int chunkSize)
+        : m_size(size)
+        , m_pos(0)
+        , m_chunk(chunkSize, 0)
+    {
+        setStreamSize(size);
+        setStreamSeekable(true);
+    }
+
+protected:
+    void reset()
+    {
+        m_pos = 0;
+    }
+
+    void needData()
+    {
+        if (m_pos >= m_size) {
+            endOfData();
+            return;
+        }
+        const int length = static_cast<int>(qMin<qint64>(m_chunk.size(), m_size - m_pos));
+        // Only detaches when the reader still holds on to the last chunk.
+        char *data = m_chunk.data();
+        for (int i = 0; i < length; ++i) {
+            data[i] = patternAt(m_pos + i);
+        }
+        writeData(length == m_chunk.size() ? m_chunk : m_chunk.left(length));
+        m_pos += length;
+    }
+
+    void seekStream(qint64 offset)
+    {
+        m_pos = offset;
+    }
+
+private:
+    qint64 m_size;
+    qint64 m_pos;
+    QByteArray m_chunk;
+};
+
+/// Stands in for libVLC's input thread.
+class ReaderThread : public QThread
+{
+public:
+    ReaderThread(StreamReader *reader, qint64 size, SeekPattern pattern)
+        : m_reader(reader)
+        , m_size(size)
+        , m_pattern(pattern)
+        , m_bytes(0)
+        , m_errors(0)
+        , m_seekTime(0)
+        , m_seeks(0)
+        , m_elapsed(0)
+    {
+    }
+
+    /// Time taken by every read not following a seek, in nanoseconds.
+    QVector<qint64> m_latencies;
+    qint64 m_bytes;
+    /// Reads that returned the wrong data.
+    int m_errors;
+    /// Time taken by seeks plus the first read after them, in nanoseconds.
+    qint64 m_seekTime;
+    int m_seeks;
+    qint64 m_elapsed;
+
+protected:
+    void run()
+    {
+        QElapsedTimer total;
+        total.start();
+        QElapsedTimer timer;
+        quint64 random = 1;
+        int reads = 0;
+        bool seeked = false;
+
+        forever {
+            if (m_pattern != Sequential && ++reads % 64 == 0) {
+                quint64 target;
+                if (m_pattern == ShortForward) {
+                    target = m_reader->currentPos() + 16 * 1024;
+                } else {
+                    random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+                    target = (random >> 16) % static_cast<quint64>(m_size);
+                }
+                if (target >= static_cast<quint64>(m_size)) {
+                    break;
+                }
+                timer.start();
+                StreamReader::seekCallback(m_reader, target);
+                seeked = true;
+            } else {
+                timer.start();
+            }
+
+            int64_t dts, pts; // krazy:exclude=typedefs
+            unsigned flags;
+            size_t size = 0;
+            void *buffer = 0;
+            const quint64 pos = m_reader->currentPos();
+            const int ret = StreamReader::readCallback(m_reader, 0, &dts, &pts, &flags, &size, &buffer);
+            const qint64 elapsed = timer.nsecsElapsed();
+            if (ret != 0 || size == 0) {
+                StreamReader::readDoneCallback(m_reader, 0, size, buffer);
+                break;
+            }
+
+            if (seeked) {
+                m_seekTime += elapsed;
+                ++m_seeks;
+                seeked = false;
+            } else {
+                m_latencies.append(elapsed);
+            }
+            // All of it, the producer might have overwritten any part.
+            const char *data = static_cast<const char *>(buffer);
+            for (size_t i = 0; i < size; ++i) {
+                if (data[i] != patternAt(pos + i)) {
+                    ++m_errors;
+                    break;
+                }
+            }
+            m_bytes += size;
+            StreamReader::readDoneCallback(m_reader, 0, size, buffer);
+
+            if (m_pattern == Random && m_bytes >= m_size) {
+                break;
+            }
+        }
+        m_elapsed = total.nsecsElapsed();
+    }
+
+private:
+    StreamReader *m_reader;
+    qint64 m_size;
+    SeekPattern m_pattern;
+};
+
+static qint64 percentile(const QVector<qint64> &sorted, int percent)
+{
+    if (sorted.isEmpty()) {
+        return 0;
+    }
+    return sorted.at(qMin(sorted.size() - 1, sorted.size() * percent / 100));
+}
+
+static void runOnce(qint64 size, int chunkSize, int readSize, SeekPattern pattern)
+{
+    SyntheticStream stream(size, chunkSize);
+    StreamReader reader(0);
+    reader.setReadSizeBounds(readSize, readSize);
+    reader.connectToSource(Phonon::MediaSource(&stream));
+    reader.setStreamSize(size);
+    reader.setStreamSeekable(true);
+    reader.lock();
+
+    // The producer lives in this thread's event loop, like it would in an
+    // application.
+    ReaderThread thread(&reader, size, pattern);
+    QEventLoop loop;
+    QObject::connect(&thread, SIGNAL(finished()), &loop, SLOT(quit()));
+    thread.start();
+    loop.exec();
+    thread.wait();
+
+    QVector<qint64> sorted = thread.m_latencies;
+    qSort(sorted);
+    const StreamReader::Statistics statistics = reader.statistics();
+    const double seconds = thread.m_elapsed / 1e9;
+    printf("%8d %8d %-14s %9.1f %9.1f %9.1f %7d %9.1f %7d %9.1f %s\n",
+           chunkSize, readSize, seekPatternName(pattern),
+           thread.m_bytes / seconds / (1024 * 1024),
+           percentile(sorted, 50) / 1e3, percentile(sorted, 99) / 1e3,
+           statistics.waits, statistics.waitTime / 1e3,
+           thread.m_seeks, thread.m_seeks ? thread.m_seekTime / thread.m_seeks / 1e3 : 0.0,
+           thread.m_errors ? "CORRUPT" : "");
+
+    reader.unlock();
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    qint64 size = 256;
+    if (argc > 1) {
+        size = QByteArray(argv[1]).toLongLong();
+    }
+    size *= 1024 * 1024;
+
+    static const int chunkSizes[] = { 4096, 65536, 1024 * 1024 };
+    static const int readSizes[] = { 4096, 32768, 65536 };
+    static const SeekPattern patterns[] = { Sequential, ShortForward, Random };
+
+    printf("%8s %8s %-14s %9s %9s %9s %7s %9s %7s %9s\n",
+           "write", "read", "seeks", "MiB/s", "p50 us", "p99 us",
+           "waits", "wait ms", "seeks", "seek us");
+    for (unsigned c = 0; c < sizeof(chunkSizes) / sizeof(*chunkSizes); ++c) {
+        for (unsigned r = 0; r < sizeof(readSizes) / sizeof(*readSizes); ++r) {
+            for (unsigned p = 0; p < sizeof(patterns) / sizeof(*patterns); ++p) {
+                runOnce(size, chunkSizes[c], readSizes[r], patterns[p]);
+            }
+        }
+    }
+    return 0;
+}
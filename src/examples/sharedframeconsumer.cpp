@@ -0,0 +1,207 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Reference reader for frames published by SharedFrameOutput, see
+ * sharedframering.h. On purpose it uses nothing but that header and POSIX, to
+ * show what a consumer outside of Qt has to do.
+ *
+ * Start the player with PHONON_VLC_SHARED_FRAMES=/name set, its media
+ * objects then publish in /name-<pid>-0, /name-<pid>-1 and so on. Run
+ *   phonon_vlc_sharedframeconsumer /name-<pid>-0 [file]
+ * It prints what it sees once a second and, given a file, appends the raw
+ * planes of every frame it manages to read intact.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "video/sharedframering.h"
+
+using namespace Phonon::VLC;
+
+struct Mapping {
+    int fd;
+    unsigned char *data;
+    uint64_t size;
+    uint64_t generation;
+};
+
+static void sleepMs(long ms)
+{
+    struct timespec delay = { 0, ms * 1000000L };
+    nanosleep(&delay, 0);
+}
+
+static double now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/// (Re)maps the object when the writer changed its format, false while it does.
+static bool update(Mapping *mapping)
+{
+    const SharedFrameHeader *header = reinterpret_cast<SharedFrameHeader *>(mapping->data);
+    const uint64_t generation = sharedFrameLoad(&header->generation);
+    if (generation & 1)
+        return false;
+    if (generation == mapping->generation && header->size <= mapping->size)
+        return true;
+
+    struct stat status;
+    if (fstat(mapping->fd, &status) != 0)
+        return false;
+    void *data = mmap(0, status.st_size, PROT_READ, MAP_SHARED, mapping->fd, 0);
+    if (data == MAP_FAILED)
+        return false;
+    munmap(mapping->data, mapping->size);
+    mapping->data = static_cast<unsigned char *>(data);
+    mapping->size = status.st_size;
+
+    header = reinterpret_cast<SharedFrameHeader *>(mapping->data);
+    if (header->size > mapping->size || sharedFrameLoad(&header->generation) != generation)
+        return false;
+    mapping->generation = generation;
+    printf("format %.4s %ux%u, %u planes, %u slots\n", header->chroma,
+           header->width, header->height, header->planeCount, header->slotCount);
+    return true;
+}
+
+/// \returns whether all planes of \p slot lie within what we mapped
+static bool planesMapped(const Mapping *mapping, const SharedFrameSlot *slot, uint32_t planeCount)
+{
+    if (planeCount > SharedFrameMaxPlanes)
+        return false;
+    for (uint32_t i = 0; i < planeCount; ++i) {
+        const uint64_t length = static_cast<uint64_t>(slot->pitch[i]) * slot->lines[i];
+        if (slot->offset[i] > mapping->size || length > mapping->size - slot->offset[i])
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s /name [file]\n", argv[0]);
+        return 1;
+    }
+
+    Mapping mapping = { -1, 0, 0, ~0ULL };
+    while ((mapping.fd = shm_open(argv[1], O_RDONLY, 0)) < 0)
+        sleepMs(100);
+
+    // The writer may not have set the header up yet.
+    const SharedFrameHeader *header = 0;
+    for (;;) {
+        struct stat status;
+        if (fstat(mapping.fd, &status) == 0 && status.st_size >= static_cast<off_t>(sizeof(SharedFrameHeader))) {
+            mapping.size = status.st_size;
+            mapping.data = static_cast<unsigned char *>(mmap(0, mapping.size, PROT_READ, MAP_SHARED, mapping.fd, 0));
+            if (mapping.data == MAP_FAILED) {
+                perror("mmap");
+                return 1;
+            }
+            header = reinterpret_cast<SharedFrameHeader *>(mapping.data);
+            if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) == SharedFrameMagic)
+                break;
+            munmap(mapping.data, mapping.size);
+        }
+        sleepMs(100);
+    }
+    if (header->version != SharedFrameVersion) {
+        fprintf(stderr, "unsupported version %u\n", header->version);
+        return 1;
+    }
+
+    FILE *out = argc > 2 ? fopen(argv[2], "wb") : 0;
+    static unsigned char copy[64 * 1024 * 1024];
+
+    uint64_t last = 0;
+    unsigned long frames = 0, torn = 0, missed = 0;
+    double reported = now();
+    for (;;) {
+        if (!update(&mapping)) {
+            sleepMs(1);
+            continue;
+        }
+        header = reinterpret_cast<SharedFrameHeader *>(mapping.data);
+
+        const uint64_t sequence = sharedFrameLoad(&header->latestSequence);
+        if (sequence == 0 || sequence == last) {
+            sleepMs(1);
+            continue;
+        }
+        const SharedFrameSlot *slot = &header->slot[sequence % header->slotCount];
+        if (sharedFrameLoad(&slot->sequence) != sequence)
+            continue;
+        // The format may have changed since update(), sending the offsets
+        // past what we mapped. Check a copy of the layout before touching any
+        // plane, so it cannot change under our feet after the check.
+        const SharedFrameSlot layout = *slot;
+        const uint32_t planeCount = header->planeCount;
+        if (sharedFrameLoad(&header->generation) != mapping.generation
+                || !planesMapped(&mapping, &layout, planeCount))
+            continue;
+
+        // A real consumer would upload or encode the planes right here. This
+        // one sums a byte of every cache line, so all of them get touched.
+        const int64_t pts = layout.pts;
+        uint32_t checksum = 0;
+        size_t copied = 0;
+        for (uint32_t i = 0; i < planeCount; ++i) {
+            const unsigned char *plane = mapping.data + layout.offset[i];
+            const size_t length = static_cast<size_t>(layout.pitch[i]) * layout.lines[i];
+            for (size_t j = 0; j < length; j += 64)
+                checksum += plane[j];
+            if (out && copied + length <= sizeof(copy)) {
+                memcpy(copy + copied, plane, length);
+                copied += length;
+            }
+        }
+
+        sharedFrameReadBarrier();
+        if (sharedFrameLoad(&slot->sequence) != sequence) {
+            ++torn;
+            continue;
+        }
+
+        if (last && sequence > last + 1)
+            missed += sequence - last - 1;
+        last = sequence;
+        ++frames;
+        if (out)
+            fwrite(copy, 1, copied, out);
+
+        const double time = now();
+        if (time - reported >= 1.0) {
+            printf("frame %llu pts %.3fs checksum %08x: %lu read, %lu torn, %lu missed\n",
+                   static_cast<unsigned long long>(sequence), pts / 1e6, checksum,
+                   frames, torn, missed);
+            fflush(stdout);
+            reported = time;
+        }
+    }
+    return 0;
+}
@@ -32,6 +32,33 @@ Media::Media(const QByteArray &mrl, QObject *parent) :
     QObject(parent),
     m_media(libvlc_media_new_location(libvlc, mrl.constData())),
     m_mrl(mrl)
+{
+    attachEvents();
+}
+
+#if (LIBVLC_VERSION_INT >= LIBVLC_VERSION(3, 0, 0, 0))
+Media::Media(libvlc_media_open_cb openCallback,
+             libvlc_media_read_cb readCallback,
+             libvlc_media_seek_cb seekCallback,
+             libvlc_media_close_cb closeCallback,
+             void *opaque, QObject *parent) :
+    QObject(parent),
+    m_media(libvlc_media_new_callbacks(libvlc, openCallback, readCallback,
+                                       seekCallback, closeCallback, opaque))
+{
+    attachEvents();
+}
+#endif
+
+Media::~Media()
+{
+    if (m_media) {
+        libvlc_media_release(m_media);
+        m_media = 0;
+    }
+}
+
+void Media::attachEvents()
 {
     Q_ASSERT(m_media);
 
@@ -50,14 +77,6 @@ Media::Media(const QByteArray &mrl, QObject *parent) :
     }
 }
 
-Media::~Media()
-{
-    if (m_media) {
-        libvlc_media_release(m_media);
-        m_media = 0;
-    }
-}
-
 void Media::addOption(const QString &option)
 {
     libvlc_media_add_option_flag(m_media,
@@ -65,6 +84,16 @@ void Media::addOption(const QString &option)
                                  libvlc_media_option_trusted);
 }
 
+void Media::addVideoFilter(const QString &filter)
+{
+    if (m_videoFilters.isEmpty())
+        m_videoFilters = LibVLC::self->videoFilters();
+    if (m_videoFilters.contains(filter))
+        return;
+    m_videoFilters.append(filter);
+    addOption(QLatin1String(":video-filter=") % m_videoFilters.join(QLatin1String(":")));
+}
+
 QString Media::meta(libvlc_meta_t meta)
 {
     return VString(libvlc_media_get_meta(m_media, meta)).toQString();
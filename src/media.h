@@ -20,10 +20,12 @@
 
 #include <QtCore/QObject>
 #include <QtCore/QStringBuilder>
+#include <QtCore/QStringList>
 #include <QtCore/QVariant>
 
 #include <vlc/libvlc.h>
 #include <vlc/libvlc_media.h>
+#include <vlc/libvlc_version.h>
 
 #define INTPTR_PTR(x) reinterpret_cast<intptr_t>(x)
 #define INTPTR_FUNC(x) reinterpret_cast<intptr_t>(&x)
@@ -36,6 +38,14 @@ class Media : public QObject
     Q_OBJECT
 public:
     explicit Media(const QByteArray &mrl, QObject *parent = 0);
+#if (LIBVLC_VERSION_INT >= LIBVLC_VERSION(3, 0, 0, 0))
+    /// Creates a media reading its data through the given callbacks.
+    Media(libvlc_media_open_cb openCallback,
+          libvlc_media_read_cb readCallback,
+          libvlc_media_seek_cb seekCallback,
+          libvlc_media_close_cb closeCallback,
+          void *opaque, QObject *parent = 0);
+#endif
     ~Media();
 
     inline libvlc_media_t *libvlc_media() const { return m_media; }
@@ -55,6 +65,13 @@ public:
 
     void addOption(const QString &option);
 
+    /**
+     * Appends \p filter to the video filter chain of this media. Filters set
+     * in VLC's configuration and by other sinks are kept, as VLC only honors
+     * the last video-filter option.
+     */
+    void addVideoFilter(const QString &filter);
+
     QString meta(libvlc_meta_t meta);
 
     void setCdTrack(int track);
@@ -64,11 +81,13 @@ signals:
     void metaDataChanged();
 
 private:
+    void attachEvents();
     static void event_cb(const libvlc_event_t *event, void *opaque);
 
     libvlc_media_t *m_media;
     libvlc_state_t m_state;
     QByteArray m_mrl;
+    QStringList m_videoFilters;
 };
 
 } // namespace VLC
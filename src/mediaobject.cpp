@@ -22,6 +22,7 @@
 
 #include "mediaobject.h"
 
+#include <QtCore/QCoreApplication>
 #include <QtCore/QDir>
 #include <QtCore/QStringBuilder>
 #include <QtCore/QUrl>
@@ -34,6 +35,9 @@
 #include "media.h"
 #include "sinknode.h"
 #include "streamreader.h"
+#ifdef Q_OS_UNIX
+#include "video/sharedframeoutput.h"
+#endif
 
 //Time in milliseconds before sending aboutToFinish() signal
 //2 seconds
@@ -50,6 +54,7 @@ MediaObject::MediaObject(QObject *parent)
     , m_tickInterval(0)
     , m_transitionTime(0)
     , m_media(0)
+    , m_sharedFrameOutput(0)
 {
     qRegisterMetaType<QMultiMap<QString, QString> >("QMultiMap<QString, QString>");
 
@@ -70,10 +75,23 @@ MediaObject::MediaObject(QObject *parent)
     connect(m_refreshTimer, SIGNAL(timeout()), this, SLOT(refreshDescriptors()));
 
     resetMembers();
+
+    // Every media object needs an object of its own, in this process and in
+    // any other one inheriting the variable, so it only gives the prefix.
+    const QByteArray sharedFramePrefix = qgetenv("PHONON_VLC_SHARED_FRAMES");
+    if (!sharedFramePrefix.isEmpty()) {
+        static QAtomicInt s_sharedFrameCount;
+        setSharedFrameName(QString::fromLatin1("%1-%2-%3")
+                           .arg(QString::fromLocal8Bit(sharedFramePrefix))
+                           .arg(QCoreApplication::applicationPid())
+                           .arg(s_sharedFrameCount.fetchAndAddRelaxed(1)));
+    }
 }
 
 MediaObject::~MediaObject()
 {
+    setSharedFrameName(QString());
+    updateSharedFrameOutput();
     unloadMedia();
 }
 
@@ -401,6 +419,8 @@ void MediaObject::setSource(const MediaSource &source)
         // https://bugs.kde.org/show_bug.cgi?id=293012
         connect(m_streamReader, SIGNAL(streamSeekableChanged(bool)), this, SIGNAL(seekableChanged(bool)));
         disconnect(m_player, SIGNAL(seekableChanged(bool)), this, SIGNAL(seekableChanged(bool)));
+        if (source.stream())
+            m_streamReader->loadElementaryStreamFormat(source.stream());
         // Only connect now to avoid seekability detection before we are connected.
         m_streamReader->connectToSource(source);
         loadMedia(QByteArray("imem://"));
@@ -527,7 +547,13 @@ void MediaObject::setupMedia()
     resetMembers();
 
     // Create a media with the given MRL
-    m_media = new Media(m_mrl, this);
+    if (m_streamReader)
+        // StreamReader is no sink but a source, for this we have no concept right now
+        // also we do not need one since the reader is the only source we have.
+        // Consequently we need to manually let the StreamReader create the Media.
+        m_media = m_streamReader->createMedia(this);
+    else
+        m_media = new Media(m_mrl, this);
     if (!m_media)
         error() << "libVLC:" << LibVLC::errorMessage();
 
@@ -539,12 +565,6 @@ void MediaObject::setupMedia()
     if (source().discType() == Cd && m_currentTitle > 0)
         m_media->setCdTrack(m_currentTitle);
 
-    if (m_streamReader)
-        // StreamReader is no sink but a source, for this we have no concept right now
-        // also we do not need one since the reader is the only source we have.
-        // Consequently we need to manually tell the StreamReader to attach to the Media.
-        m_streamReader->addToMedia(m_media);
-
     if (!m_subtitleAutodetect)
         m_media->addOption(QLatin1String(":no-sub-autodetect-file"));
 
@@ -567,6 +587,7 @@ void MediaObject::setupMedia()
     else
         m_media->addOption(QLatin1String(":no-freetype-bold"));
 
+    updateSharedFrameOutput();
     foreach (SinkNode *sink, m_sinks) {
         sink->addToMedia(m_media);
     }
@@ -593,6 +614,63 @@ QString MediaObject::errorString() const
     return libvlc_errmsg();
 }
 
+QVariantMap MediaObject::streamStatistics() const
+{
+    QVariantMap map;
+    if (!m_streamReader)
+        return map;
+
+    const StreamReader::Statistics statistics = m_streamReader->statistics();
+    map.insert(QLatin1String("bytesWritten"), statistics.bytesWritten);
+    map.insert(QLatin1String("bytesRead"), statistics.bytesRead);
+    map.insert(QLatin1String("needDataCalls"), statistics.needDataCalls);
+    map.insert(QLatin1String("waits"), statistics.waits);
+    map.insert(QLatin1String("waitTime"), statistics.waitTime);
+    map.insert(QLatin1String("seeks"), statistics.seeks);
+    map.insert(QLatin1String("bufferFill"), statistics.bufferFill);
+    return map;
+}
+
+QString MediaObject::sharedFrameName() const
+{
+    return m_sharedFrameName;
+}
+
+void MediaObject::setSharedFrameName(const QString &name)
+{
+#ifdef Q_OS_UNIX
+    m_sharedFrameName = name;
+#else
+    if (!name.isEmpty())
+        warning() << "Sharing frames is not supported on this platform";
+#endif
+}
+
+void MediaObject::updateSharedFrameOutput()
+{
+#ifdef Q_OS_UNIX
+    const QByteArray name = m_sharedFrameName.toLocal8Bit();
+    if (m_sharedFrameOutput && m_sharedFrameOutput->name() == name)
+        return;
+    if (!m_sharedFrameOutput && name.isEmpty())
+        return;
+
+    if (m_sharedFrameOutput) {
+        // A running video output keeps calling into the old output and
+        // writing into its mapping. Stopping joins it.
+        m_player->stop();
+        delete m_sharedFrameOutput;
+        m_sharedFrameOutput = 0;
+    }
+    if (name.isEmpty())
+        return;
+
+    m_sharedFrameOutput = new SharedFrameOutput(name);
+    if (m_sharedFrameOutput->isValid())
+        m_sharedFrameOutput->connectToMediaObject(this);
+#endif
+}
+
 bool MediaObject::hasVideo() const
 {
     return m_player->hasVideoOutput();
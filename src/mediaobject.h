@@ -24,6 +24,7 @@
 
 #include <QtCore/QObject>
 #include <QtCore/QTimer>
+#include <QtCore/QVariantMap>
 
 #include <phonon/mediaobjectinterface.h>
 #include <phonon/addoninterface.h>
@@ -37,6 +38,7 @@ namespace VLC
 {
 
 class Media;
+class SharedFrameOutput;
 class SinkNode;
 class StreamReader;
 
@@ -69,6 +71,9 @@ class MediaObject : public QObject, public MediaObjectInterface, public MediaCon
 {
     Q_OBJECT
     Q_INTERFACES(Phonon::MediaObjectInterface Phonon::AddonInterface)
+    /// Counters of the StreamReader of a MediaSource::Stream, empty otherwise.
+    Q_PROPERTY(QVariantMap streamStatistics READ streamStatistics)
+    Q_PROPERTY(QString sharedFrameName READ sharedFrameName WRITE setSharedFrameName)
     friend class SinkNode;
 
 public:
@@ -111,6 +116,28 @@ public:
     /// \returns An error message with the last libVLC error.
     QString errorString() const;
 
+    /**
+     * \returns a snapshot of the stream reader's counters, keyed by the names
+     * of the StreamReader::Statistics members, or an empty map if the current
+     * source is no stream.
+     */
+    QVariantMap streamStatistics() const;
+
+    /// \returns the name of the shared memory object video goes to, if any
+    QString sharedFrameName() const;
+
+    /**
+     * Makes video go to a SharedFrameOutput publishing frames in the POSIX
+     * shared memory object \p name, for other processes to read, instead of
+     * the screen. An empty name stops that. Takes effect with the next media
+     * played. Every media object needs a name of its own.
+     *
+     * If the PHONON_VLC_SHARED_FRAMES environment variable is set, media
+     * objects default to its value followed by the process id and a counter,
+     * e.g. "/phonon-vlc-1234-0". Only available on Unix.
+     */
+    void setSharedFrameName(const QString &name);
+
     /**
      * Adds a sink for this media object. During playInternal(), all the sinks
      * will have their addToMedia() called.
@@ -303,6 +330,13 @@ private:
      */
     void unloadMedia();
 
+    /**
+     * Replaces the SharedFrameOutput if setSharedFrameName() changed the name.
+     * VLC's video output uses the old one until it is closed, so this stops
+     * the player before freeing it.
+     */
+    void updateSharedFrameOutput();
+
     MediaSource m_nextSource;
 
     MediaSource m_mediaSource;
@@ -319,6 +353,9 @@ private:
     qint32 m_transitionTime;
 
     Media *m_media;
+    SharedFrameOutput *m_sharedFrameOutput;
+    /// Name set through setSharedFrameName(), applied by setupMedia().
+    QString m_sharedFrameName;
 
     qint64 m_totalTime;
     QByteArray m_mrl;
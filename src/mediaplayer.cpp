@@ -44,6 +44,10 @@
         Qt::QueuedConnection, \
         Q_ARG(MediaPlayer::State, __state))
 
+// Microseconds estimatedTime() runs past the last time report at most, VLC
+// reports about four times a second while playing.
+#define MAXESTIMATE 1000000
+
 namespace Phonon {
 namespace VLC {
 
@@ -52,6 +56,9 @@ MediaPlayer::MediaPlayer(QObject *parent)
     , m_media(0)
     , m_player(libvlc_media_player_new(libvlc))
     , m_doingPausedPlay(false)
+    , m_reportedTime(-1)
+    , m_timeAdvancing(false)
+    , m_rate(1.0f)
     , m_volume(75)
     , m_fadeAmount(1.0f)
 {
@@ -102,6 +109,7 @@ MediaPlayer::~MediaPlayer()
 void MediaPlayer::setMedia(Media *media)
 {
     m_media = media;
+    setEstimatedTime(-1, false);
     libvlc_media_player_set_media(m_player, *m_media);
 }
 
@@ -138,6 +146,7 @@ void MediaPlayer::stop()
 {
     m_doingPausedPlay = false;
     libvlc_media_player_stop(m_player);
+    setEstimatedTime(-1, false);
 }
 
 qint64 MediaPlayer::length() const
@@ -150,6 +159,47 @@ qint64 MediaPlayer::time() const
     return libvlc_media_player_get_time(m_player);
 }
 
+qint64 MediaPlayer::estimatedTime() const
+{
+    QMutexLocker lock(&m_timeMutex);
+    return estimatedTimeLocked();
+}
+
+qint64 MediaPlayer::estimatedTimeLocked() const
+{
+    if (m_reportedTime < 0 || !m_timeAdvancing)
+        return m_reportedTime;
+    const qint64 elapsed = qMin<qint64>(m_reportClock.nsecsElapsed() / 1000, MAXESTIMATE);
+    return m_reportedTime + static_cast<qint64>(elapsed * m_rate);
+}
+
+void MediaPlayer::setEstimatedTime(qint64 time, bool advancing)
+{
+    QMutexLocker lock(&m_timeMutex);
+    m_reportedTime = time;
+    m_reportClock.start();
+    m_timeAdvancing = advancing;
+}
+
+void MediaPlayer::setTimeAdvancing(bool advancing)
+{
+    QMutexLocker lock(&m_timeMutex);
+    m_reportedTime = estimatedTimeLocked();
+    m_reportClock.start();
+    m_timeAdvancing = advancing;
+}
+
+void MediaPlayer::setRate(float rate)
+{
+    m_timeMutex.lock();
+    // Re-anchor so the time so far keeps the old rate.
+    m_reportedTime = estimatedTimeLocked();
+    m_reportClock.start();
+    m_rate = rate;
+    m_timeMutex.unlock();
+    libvlc_media_player_set_rate(m_player, rate);
+}
+
 void MediaPlayer::setTime(qint64 newTime)
 {
     libvlc_media_player_set_time(m_player, newTime);
@@ -210,6 +260,10 @@ void MediaPlayer::event_cb(const libvlc_event_t *event, void *opaque)
     // Do not forget to register for the events you want to handle here!
     switch (event->type) {
     case libvlc_MediaPlayerTimeChanged:
+        that->m_timeMutex.lock();
+        that->m_reportedTime = event->u.media_player_time_changed.new_time * 1000;
+        that->m_reportClock.start();
+        that->m_timeMutex.unlock();
         QMetaObject::invokeMethod(
                     that, "timeChanged",
                     Qt::QueuedConnection,
@@ -258,17 +312,22 @@ void MediaPlayer::event_cb(const libvlc_event_t *event, void *opaque)
             }
         } else
             P_EMIT_STATE(PlayingState);
+        that->setTimeAdvancing(true);
         break;
     case libvlc_MediaPlayerPaused:
+        that->setTimeAdvancing(false);
         P_EMIT_STATE(PausedState);
         break;
     case libvlc_MediaPlayerStopped:
+        that->setTimeAdvancing(false);
         P_EMIT_STATE(StoppedState);
         break;
     case libvlc_MediaPlayerEndReached:
+        that->setTimeAdvancing(false);
         P_EMIT_STATE(EndedState);
         break;
     case libvlc_MediaPlayerEncounteredError:
+        that->setTimeAdvancing(false);
         P_EMIT_STATE(ErrorState);
         break;
     case libvlc_MediaPlayerVout:
@@ -348,6 +407,7 @@ void MediaPlayer::setCdTrack(int track)
     if (!m_media)
         return;
     libvlc_media_player_stop(m_player);
+    setEstimatedTime(-1, false);
     m_media->setCdTrack(track);
     libvlc_media_player_set_media(m_player, *m_media);
     libvlc_media_player_play(m_player);
@@ -18,6 +18,8 @@
 #ifndef PHONON_VLC_MEDIAPLAYER_H
 #define PHONON_VLC_MEDIAPLAYER_H
 
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutex>
 #include <QtCore/QObject>
 #include <QtCore/QSize>
 
@@ -74,6 +76,23 @@ public:
     qint64 time() const;
     void setTime(qint64 newTime);
 
+    /**
+     * \returns the player time in microseconds, -1 if there was no time
+     * change event since the media was set or playback stopped.
+     *
+     * VLC only reports the time every 250 ms or so, in between this advances
+     * from the last report with a monotonic clock at the playback rate while
+     * playing. It is as exact as VLC's reports, which come a few milliseconds
+     * late, and never runs more than a second past the last one.
+     *
+     * Unlike time() this does not call into libVLC, so it is safe to use from
+     * the vout thread, which stop() joins while holding the input lock.
+     */
+    qint64 estimatedTime() const;
+
+    /// Sets the playback rate, 1 being normal speed.
+    void setRate(float rate);
+
     bool isSeekable() const;
 
     // Video
@@ -92,6 +111,17 @@ public:
     void setVideoAspectRatio(const QByteArray &aspect)
     { libvlc_video_set_aspect_ratio(m_player, aspect.isEmpty() ? 0 : aspect.data()); }
 
+    /// Set new video crop geometry.
+    /// \param geometry either a ratio ("16:9") to crop the video to,
+    ///                 a pixel geometry ("1920x800+0+140") or empty to not crop
+    void setVideoCropGeometry(const QByteArray &geometry)
+    { libvlc_video_set_crop_geometry(m_player, geometry.isEmpty() ? 0 : geometry.constData()); }
+
+    /// Set new video scale factor.
+    /// \param factor scale factor or 0 to fit the video into the window
+    void setVideoScale(float factor)
+    { libvlc_video_set_scale(m_player, factor); }
+
     void setVideoAdjust(libvlc_video_adjust_option_t adjust, int value)
     { libvlc_video_set_adjust_int(m_player, adjust, value); }
 
@@ -182,11 +212,28 @@ private:
     static void event_cb(const libvlc_event_t *event, void *opaque);
     void setVolumeInternal();
 
+    /// Anchors estimatedTime() at \p time, -1 to forget it.
+    void setEstimatedTime(qint64 time, bool advancing);
+    /// Anchors estimatedTime() where it is now and starts or stops it advancing.
+    void setTimeAdvancing(bool advancing);
+    /// m_timeMutex must be locked.
+    qint64 estimatedTimeLocked() const;
+
     Media *m_media;
 
     libvlc_media_player_t *m_player;
 
     bool m_doingPausedPlay;
+
+    /// Guards the estimatedTime() state, written from the event thread.
+    mutable QMutex m_timeMutex;
+    /// Time of the last report in microseconds, -1 if none.
+    qint64 m_reportedTime;
+    /// Runs since m_reportedTime was reported.
+    QElapsedTimer m_reportClock;
+    /// Whether playback is running, so the time advances.
+    bool m_timeAdvancing;
+    float m_rate;
     int m_volume;
     qreal m_fadeAmount;
 };
@@ -0,0 +1,112 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "streamblock.h"
+
+#include <QtCore/QMutexLocker>
+
+namespace Phonon {
+namespace VLC {
+
+StreamBlock::StreamBlock(StreamBlockPool *pool, int size)
+    : m_pool(pool)
+    , m_data(new char[size])
+    , m_size(size)
+    , m_ref(1)
+{
+}
+
+StreamBlock::~StreamBlock()
+{
+    delete[] m_data;
+}
+
+void StreamBlock::deref()
+{
+    if (!m_ref.deref())
+        m_pool->recycle(this);
+}
+
+StreamBlockPool::StreamBlockPool(int blockSize, int maxFree)
+    : m_blockSize(blockSize)
+    , m_maxFree(maxFree)
+    , m_released(false)
+    , m_ref(1)
+{
+    m_free.reserve(maxFree);
+}
+
+StreamBlockPool::~StreamBlockPool()
+{
+    // Not qDeleteAll(), only we may delete blocks.
+    foreach (StreamBlock *block, m_free) {
+        delete block;
+    }
+}
+
+StreamBlock *StreamBlockPool::acquire()
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        if (!m_free.isEmpty()) {
+            StreamBlock *block = m_free.last();
+            m_free.removeLast();
+            block->m_ref.storeRelease(1);
+            return block;
+        }
+    }
+    m_ref.ref();
+    return new StreamBlock(this, m_blockSize);
+}
+
+void StreamBlockPool::release()
+{
+    QVector<StreamBlock *> unused;
+    {
+        QMutexLocker lock(&m_mutex);
+        m_released = true;
+        unused.swap(m_free);
+    }
+    foreach (StreamBlock *block, unused) {
+        delete block;
+        deref();
+    }
+    deref();
+}
+
+void StreamBlockPool::recycle(StreamBlock *block)
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        // Once the owner is gone nobody is going to acquire blocks anymore.
+        if (!m_released && m_free.size() < m_maxFree) {
+            m_free.append(block);
+            return;
+        }
+    }
+    delete block;
+    deref();
+}
+
+void StreamBlockPool::deref()
+{
+    if (!m_ref.deref())
+        delete this;
+}
+
+} // namespace VLC
+} // namespace Phonon
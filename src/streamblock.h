@@ -0,0 +1,104 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_VLC_STREAMBLOCK_H
+#define PHONON_VLC_STREAMBLOCK_H
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
+
+namespace Phonon {
+namespace VLC {
+
+class StreamBlockPool;
+
+/** \brief Reference counted chunk of stream data
+ *
+ * Blocks are handed out by a StreamBlockPool and go back to it once the last
+ * reference is dropped. This allows passing pointers into a block to libVLC
+ * and getting the block back once libVLC is done with it, without copying.
+ */
+class StreamBlock
+{
+public:
+    char *data() const { return m_data; }
+    int size() const { return m_size; }
+
+    void ref() { m_ref.ref(); }
+    /// Drops a reference, the block goes back to its pool when it was the last one.
+    void deref();
+
+    /// \returns whether anyone but the caller holds a reference
+    bool isShared() const { return m_ref.loadAcquire() > 1; }
+
+private:
+    friend class StreamBlockPool;
+    StreamBlock(StreamBlockPool *pool, int size);
+    ~StreamBlock();
+    Q_DISABLE_COPY(StreamBlock)
+
+    StreamBlockPool *m_pool;
+    char *m_data;
+    int m_size;
+    QAtomicInt m_ref;
+};
+
+/** \brief Recycles StreamBlocks of a fixed size
+ *
+ * The pool is reference counted itself: every block out there holds on to it,
+ * so blocks libVLC still has can be released after their StreamReader is gone.
+ * The owner drops its reference with release() instead of deleting the pool.
+ */
+class StreamBlockPool
+{
+public:
+    /**
+     * \param blockSize size of every block handed out
+     * \param maxFree number of unused blocks kept around for reuse
+     */
+    StreamBlockPool(int blockSize, int maxFree = 16);
+
+    int blockSize() const { return m_blockSize; }
+
+    /// \returns a block with a reference count of one
+    StreamBlock *acquire();
+
+    /// Drops the owner's reference, the pool goes away with its last block.
+    void release();
+
+private:
+    friend class StreamBlock;
+    ~StreamBlockPool();
+    Q_DISABLE_COPY(StreamBlockPool)
+
+    void recycle(StreamBlock *block);
+    void deref();
+
+    const int m_blockSize;
+    const int m_maxFree;
+    QMutex m_mutex;
+    QVector<StreamBlock *> m_free;
+    bool m_released;
+    /// One for the owner plus one for every block alive.
+    QAtomicInt m_ref;
+};
+
+} // namespace VLC
+} // namespace Phonon
+
+#endif // PHONON_VLC_STREAMBLOCK_H
@@ -0,0 +1,196 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "streamrangecache.h"
+
+#include "streamblock.h"
+
+namespace Phonon {
+namespace VLC {
+
+StreamRangeCache::StreamRangeCache(qint64 capacity)
+    : m_capacity(capacity)
+    , m_size(0)
+    , m_pinnedSize(0)
+{
+}
+
+StreamRangeCache::~StreamRangeCache()
+{
+    clear();
+}
+
+void StreamRangeCache::setCapacity(qint64 capacity)
+{
+    m_capacity = capacity;
+    evict();
+}
+
+void StreamRangeCache::insert(quint64 pos, StreamBlock *block, const char *data, int length)
+{
+    if (m_capacity <= 0 || length <= 0)
+        return;
+
+    punch(pos, pos + length);
+
+    // Sequential reading mostly continues right where the previous range
+    // ended in the same block, so grow that one instead of adding a new one.
+    RangeMap::iterator it = m_ranges.lowerBound(pos);
+    if (it != m_ranges.begin()) {
+        --it;
+        Range &previous = it.value();
+        if (it.key() + previous.length == pos && previous.block == block
+                && previous.data + previous.length == data) {
+            previous.length += length;
+            touch(previous);
+            m_size += length;
+            evict();
+            return;
+        }
+    }
+
+    block->ref();
+    pin(block);
+    Range range = { block, data, length, m_uses.insert(m_uses.end(), pos) };
+    m_ranges.insert(pos, range);
+    m_size += length;
+    evict();
+}
+
+int StreamRangeCache::find(quint64 pos, const char **data, StreamBlock **block)
+{
+    RangeMap::iterator it = m_ranges.upperBound(pos);
+    if (it == m_ranges.begin())
+        return 0;
+    --it;
+
+    Range &range = it.value();
+    const quint64 offset = pos - it.key();
+    if (offset >= static_cast<quint64>(range.length))
+        return 0;
+
+    touch(range);
+    *data = range.data + offset;
+    *block = range.block;
+    return range.length - static_cast<int>(offset);
+}
+
+quint64 StreamRangeCache::contiguousEnd(quint64 pos) const
+{
+    RangeMap::const_iterator it = m_ranges.upperBound(pos);
+    if (it == m_ranges.constBegin())
+        return pos;
+    --it;
+
+    quint64 end = it.key() + it.value().length;
+    if (end <= pos)
+        return pos;
+    for (++it; it != m_ranges.constEnd() && it.key() == end; ++it)
+        end += it.value().length;
+    return end;
+}
+
+void StreamRangeCache::clear()
+{
+    RangeMap::iterator it = m_ranges.begin();
+    while (it != m_ranges.end())
+        it = remove(it);
+}
+
+void StreamRangeCache::punch(quint64 pos, quint64 end)
+{
+    RangeMap::iterator it = m_ranges.lowerBound(pos);
+    if (it != m_ranges.begin()) {
+        RangeMap::iterator previous = it;
+        --previous;
+        Range &range = previous.value();
+        const quint64 rangeEnd = previous.key() + range.length;
+        if (rangeEnd > pos) {
+            if (rangeEnd > end) {
+                // The new range lies within this one, keep what is behind it.
+                Range tail = range;
+                tail.data += end - previous.key();
+                tail.length = static_cast<int>(rangeEnd - end);
+                tail.block->ref();
+                pin(tail.block);
+                // As old as the range it was cut from.
+                tail.use = m_uses.insert(range.use, end);
+                m_ranges.insert(end, tail);
+                m_size -= end - pos;
+            } else {
+                m_size -= rangeEnd - pos;
+            }
+            range.length = static_cast<int>(pos - previous.key());
+        }
+    }
+
+    it = m_ranges.lowerBound(pos);
+    while (it != m_ranges.end() && it.key() < end) {
+        const quint64 rangeEnd = it.key() + it.value().length;
+        if (rangeEnd > end) {
+            // Keep the part behind the new range, the reference moves along.
+            Range tail = it.value();
+            tail.data += end - it.key();
+            tail.length = static_cast<int>(rangeEnd - end);
+            *tail.use = end;
+            m_size -= end - it.key();
+            m_ranges.erase(it);
+            m_ranges.insert(end, tail);
+            break;
+        }
+        it = remove(it);
+    }
+}
+
+StreamRangeCache::RangeMap::iterator StreamRangeCache::remove(RangeMap::iterator it)
+{
+    m_size -= it.value().length;
+    m_uses.erase(it.value().use);
+    unpin(it.value().block);
+    it.value().block->deref();
+    return m_ranges.erase(it);
+}
+
+void StreamRangeCache::evict()
+{
+    while (m_pinnedSize > m_capacity && !m_uses.empty())
+        remove(m_ranges.find(m_uses.front()));
+}
+
+void StreamRangeCache::touch(Range &range)
+{
+    // Moves the node itself, so range.use stays valid.
+    m_uses.splice(m_uses.end(), m_uses, range.use);
+}
+
+void StreamRangeCache::pin(StreamBlock *block)
+{
+    if (m_pins[block]++ == 0)
+        m_pinnedSize += block->size();
+}
+
+void StreamRangeCache::unpin(StreamBlock *block)
+{
+    QHash<StreamBlock *, int>::iterator it = m_pins.find(block);
+    if (--it.value() == 0) {
+        m_pinnedSize -= block->size();
+        m_pins.erase(it);
+    }
+}
+
+} // namespace VLC
+} // namespace Phonon
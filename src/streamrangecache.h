@@ -0,0 +1,116 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_VLC_STREAMRANGECACHE_H
+#define PHONON_VLC_STREAMRANGECACHE_H
+
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+
+#include <list>
+
+namespace Phonon {
+namespace VLC {
+
+class StreamBlock;
+
+/** \brief Cache of already fetched byte ranges of a stream
+ *
+ * Every range references the StreamBlock its data lives in, so caching does
+ * not copy anything, it merely keeps blocks from going back to their pool.
+ * The capacity is what those blocks take in memory, however little of them
+ * is cached. When they exceed it the least recently used ranges are dropped.
+ *
+ * Not thread-safe, StreamReader only uses it from the reading thread.
+ */
+class StreamRangeCache
+{
+public:
+    /// \param capacity maximum number of bytes of blocks to keep, 0 disables the cache
+    explicit StreamRangeCache(qint64 capacity);
+    ~StreamRangeCache();
+
+    qint64 capacity() const { return m_capacity; }
+    void setCapacity(qint64 capacity);
+
+    /// \returns number of bytes currently cached
+    qint64 size() const { return m_size; }
+
+    /// \returns number of bytes of the blocks the cached ranges lie in
+    qint64 pinnedSize() const { return m_pinnedSize; }
+
+    /**
+     * Adds \p length bytes at \p data, which lie in \p block, as the range
+     * starting at stream position \p pos. Takes its own reference on \p block.
+     * Older ranges overlapping it get replaced.
+     */
+    void insert(quint64 pos, StreamBlock *block, const char *data, int length);
+
+    /**
+     * Looks up the data at stream position \p pos and marks it as used.
+     *
+     * \param data set to the cached data at \p pos
+     * \param block set to the block \p data lies in, no reference is taken
+     * \returns number of contiguous bytes at \p data, 0 if \p pos is not cached
+     */
+    int find(quint64 pos, const char **data, StreamBlock **block);
+
+    /**
+     * \returns the end of the contiguously cached data starting at \p pos, or
+     * \p pos itself when it is not cached
+     */
+    quint64 contiguousEnd(quint64 pos) const;
+
+    void clear();
+
+private:
+    Q_DISABLE_COPY(StreamRangeCache)
+
+    /// Positions of the ranges, least recently used first.
+    typedef std::list<quint64> UseList;
+
+    struct Range {
+        StreamBlock *block;
+        const char *data;
+        int length;
+        UseList::iterator use;
+    };
+    typedef QMap<quint64, Range> RangeMap;
+
+    /// Removes whatever overlaps [pos, end), trimming ranges reaching out of it.
+    void punch(quint64 pos, quint64 end);
+    RangeMap::iterator remove(RangeMap::iterator it);
+    void evict();
+    /// Marks \p range as the most recently used one.
+    void touch(Range &range);
+    /// Counts one more range lying in \p block, which must be referenced already.
+    void pin(StreamBlock *block);
+    void unpin(StreamBlock *block);
+
+    RangeMap m_ranges;
+    UseList m_uses;
+    /// Number of ranges lying in each block.
+    QHash<StreamBlock *, int> m_pins;
+    qint64 m_capacity;
+    qint64 m_size;
+    qint64 m_pinnedSize;
+};
+
+} // namespace VLC
+} // namespace Phonon
+
+#endif // PHONON_VLC_STREAMRANGECACHE_H
@@ -26,37 +26,120 @@
 
 #include "utils/debug.h"
 #include "media.h"
-#include "mediaobject.h"
+#include "streamblock.h"
+#include "streamunitheader.h"
+
+#include <string.h>
+
 #ifndef QT_NO_PHONON_ABSTRACTMEDIASTREAM
 
 namespace Phonon {
 namespace VLC {
 
-#define BLOCKSIZE 32768
+// Size of the chunks of the ring buffer. Must be a power of two and no
+// smaller than the largest read, since a read never spans two chunks.
+#define CHUNKSIZE 65536
+#define CHUNKCOUNT 128
+
+// Producers rely on this layout, see streamunitheader.h.
+Q_STATIC_ASSERT(sizeof(PhononVlcStreamUnitHeader) == 32);
+
+// Default bounds for the adaptive read size.
+#define READSIZE_MIN 4096
+#define READSIZE_MAX CHUNKSIZE
+// Length of one read size measurement window in milliseconds.
+#define READSIZE_WINDOW 250
+// How many reads per second we aim for on streams fast enough to fill them.
+#define READS_PER_SECOND 32
+
+// Seeks at most this far ahead of the buffered data wait for the data to
+// arrive instead of making the producer seek.
+#define SHORTSEEK (512 * 1024)
+// Default size of the cache of already read ranges.
+#define CACHESIZE (16 * 1024 * 1024)
+
+// Default read-ahead watermarks in bytes.
+#define READAHEAD_LOW (1024 * 1024)
+#define READAHEAD_HIGH (4 * 1024 * 1024)
 
 StreamReader::StreamReader(MediaObject *parent)
     : QObject(parent)
+    , m_pool(new StreamBlockPool(CHUNKSIZE))
+    , m_buffer(m_pool, CHUNKCOUNT)
+    , m_cache(CACHESIZE)
+    , m_cacheSize(CACHESIZE)
+    , m_spill(0)
+    , m_spillLimit(0)
     , m_pos(0)
+    , m_bufferPos(0)
     , m_size(0)
     , m_eos(false)
     , m_seekable(false)
     , m_unlocked(false)
-    , m_mediaObject(parent)
+    , m_waitingFor(0)
+    , m_stalled(false)
+    , m_readSize(READSIZE_MIN)
+    , m_readSizeMinimum(READSIZE_MIN)
+    , m_readSizeMaximum(READSIZE_MAX)
+    , m_windowBytes(0)
+    , m_windowStalls(0)
+    , m_overflowOffset(0)
+    , m_overflowSize(0)
+    , m_lowWatermark(READAHEAD_LOW)
+    , m_highWatermark(READAHEAD_HIGH)
+    , m_requesting(0)
+    , m_esCategory(0)
+    , m_unitBytes(0)
+    , m_bytesWritten(0)
+    , m_bytesRead(0)
+    , m_needDataCalls(0)
+    , m_waits(0)
+    , m_waitTime(0)
+    , m_seeks(0)
 {
 }
 
 StreamReader::~StreamReader()
 {
+    foreach (StreamBlock *block, m_blocksInFlight) {
+        block->deref();
+    }
+    // Blocks that are still around keep the pool alive.
+    m_pool->release();
+}
+
+Media *StreamReader::createMedia(QObject *parent)
+{
+#if (LIBVLC_VERSION_INT >= LIBVLC_VERSION(3, 0, 0, 0))
+    // The callbacks only do byte streams, elementary streams need imem.
+    if (!isElementaryStream()) {
+        // Without a seek callback libVLC knows not to try.
+        return new Media(openCallback, readIntoCallback, streamSeekable() ? seekCallback : 0,
+                         closeCallback, this, parent);
+    }
+#endif
+    Media *media = new Media(QByteArray("imem://"), parent);
+    addToMedia(media);
+    return media;
 }
 
 void StreamReader::addToMedia(Media *media)
 {
     lock(); // Make sure we can lock in read().
 
-    media->addOption(QLatin1String("imem-cat=4"));
     media->addOption(QLatin1String("imem-data="), INTPTR_PTR(this));
     media->addOption(QLatin1String("imem-get="), INTPTR_FUNC(readCallback));
     media->addOption(QLatin1String("imem-release="), INTPTR_FUNC(readDoneCallback));
+
+    if (isElementaryStream()) {
+        media->addOption(QLatin1String("imem-cat="), m_esCategory);
+        foreach (const QString &option, m_esOptions) {
+            media->addOption(option);
+        }
+        return;
+    }
+
+    media->addOption(QLatin1String("imem-cat=4"));
     media->addOption(QLatin1String("imem-seek="), INTPTR_FUNC(seekCallback));
 
     // if stream has known size, we may pass it
@@ -66,6 +149,35 @@ void StreamReader::addToMedia(Media *media)
     }
 }
 
+void StreamReader::loadElementaryStreamFormat(const QObject *stream)
+{
+    const QString category = stream->property("vlc-es-category").toString();
+    if (category == QLatin1String("audio")) {
+        m_esCategory = 1;
+    } else if (category == QLatin1String("video")) {
+        m_esCategory = 2;
+    } else if (category == QLatin1String("subtitle")) {
+        m_esCategory = 3;
+    } else {
+        if (!category.isEmpty()) {
+            warning() << "Unknown elementary stream category" << category;
+        }
+        m_esCategory = 0;
+        m_esOptions.clear();
+        return;
+    }
+
+    m_esOptions.clear();
+    foreach (const QByteArray &name, stream->dynamicPropertyNames()) {
+        if (!name.startsWith("vlc-es-") || name == "vlc-es-category") {
+            continue;
+        }
+        m_esOptions.append(QLatin1String("imem-") % QLatin1String(name.mid(7))
+                           % QLatin1Char('=') % stream->property(name).toString());
+    }
+    debug() << "Elementary stream mode:" << category << m_esOptions;
+}
+
 void StreamReader::lock()
 {
     QMutexLocker lock(&m_mutex);
@@ -86,19 +198,25 @@ int StreamReader::readCallback(void *data, const char *cookie,
                                size_t *bufferSize, void **buffer)
 {
     Q_UNUSED(cookie);
-    Q_UNUSED(dts);
-    Q_UNUSED(pts);
-    Q_UNUSED(flags);
 
     StreamReader *that = static_cast<StreamReader *>(data);
-    size_t length = BLOCKSIZE;
-
-    *buffer = new char[length];
+    if (that->isElementaryStream()) {
+        return that->readUnit(dts, pts, flags, bufferSize, buffer);
+    }
 
-    int size = length;
-    bool ret = that->read(that->currentPos(), &size, static_cast<char*>(*buffer));
+    // imem copies whatever we point it to into its own block before calling
+    // readDoneCallback, so we can hand out our buffer directly.
+    int size = that->readSize();
+    const char *blockData = 0;
+    StreamBlock *block = 0;
+    bool ret = that->readBlock(that->currentPos(), &size, &blockData, &block);
+    that->adaptReadSize(size, that->m_stalled);
 
+    *buffer = const_cast<char *>(blockData);
     *bufferSize = static_cast<size_t>(size);
+    if (block) {
+        that->m_blocksInFlight.insert(*buffer, block);
+    }
 
     return ret ? 0 : -1;
 }
@@ -106,10 +224,18 @@ int StreamReader::readCallback(void *data, const char *cookie,
 int StreamReader::readDoneCallback(void *data, const char *cookie,
                                    size_t bufferSize, void *buffer)
 {
-    Q_UNUSED(data);
     Q_UNUSED(cookie);
     Q_UNUSED(bufferSize);
-    delete[] static_cast<char *>(buffer);
+
+    StreamReader *that = static_cast<StreamReader *>(data);
+    if (that->isElementaryStream()) {
+        that->m_unitsInFlight.remove(buffer);
+        return 0;
+    }
+    StreamBlock *block = that->m_blocksInFlight.take(buffer);
+    if (block) {
+        block->deref();
+    }
     return 0;
 }
 
@@ -127,19 +253,149 @@ int StreamReader::seekCallback(void *data, const uint64_t pos)
     return 0;
 }
 
+#if (LIBVLC_VERSION_INT >= LIBVLC_VERSION(3, 0, 0, 0))
+int StreamReader::openCallback(void *data, void **opaque, uint64_t *size)
+{
+    StreamReader *that = static_cast<StreamReader *>(data);
+    that->lock(); // Make sure we can lock in read().
+
+    *opaque = that;
+    // libVLC takes UINT64_MAX for an unknown size.
+    *size = that->streamSize() > 0 ? static_cast<uint64_t>(that->streamSize()) : UINT64_MAX;
+    return 0;
+}
+
+ssize_t StreamReader::readIntoCallback(void *data, unsigned char *buffer, size_t length)
+{
+    StreamReader *that = static_cast<StreamReader *>(data);
+
+    // libVLC happily takes less than it asked for, so stick to the adaptive
+    // size rather than waiting for its whole buffer to fill up.
+    forever {
+        int size = static_cast<int>(qMin<size_t>(length, that->readSize()));
+        if (!that->read(that->currentPos(), &size, reinterpret_cast<char *>(buffer))) {
+            // End of stream.
+            return 0;
+        }
+        if (size > 0) {
+            that->adaptReadSize(size, that->m_stalled);
+            return size;
+        }
+
+        // libVLC takes 0 for the end of the stream, which this is not.
+        QMutexLocker lock(&that->m_mutex);
+        if (that->m_unlocked) {
+            return -1;
+        }
+    }
+}
+
+void StreamReader::closeCallback(void *data)
+{
+    Q_UNUSED(data);
+}
+#endif
+
 quint64 StreamReader::currentBufferSize() const
 {
-    return m_buffer.size();
+    return m_buffer.bytesAvailable() + m_overflowSize.loadAcquire() + m_unitBytes.loadAcquire();
+}
+
+int StreamReader::readUnit(int64_t *dts, int64_t *pts, unsigned *flags, // krazy:exclude=typedefs
+                           size_t *bufferSize, void **buffer)
+{
+    *bufferSize = 0;
+    *buffer = 0;
+
+    QByteArray unit;
+    PhononVlcStreamUnitHeader header;
+    forever {
+        {
+            QMutexLocker lock(&m_mutex);
+            m_stalled = false;
+            while (m_units.isEmpty()) {
+                // Returning no data would only make imem call us again right
+                // away. Fail like byte stream reads do once unlocked.
+                if (m_unlocked || m_eos) {
+                    return -1;
+                }
+                m_stalled = true;
+                m_requesting.storeRelease(1);
+                requestData();
+                QElapsedTimer waited;
+                waited.start();
+                m_waitingForData.wait(&m_mutex);
+                m_waits.ref();
+                m_waitTime.fetchAndAddRelaxed(waited.nsecsElapsed() / 1000);
+            }
+            unit = m_units.dequeue();
+            m_unitBytes.fetchAndAddOrdered(-unit.size());
+        }
+        updateReadAhead(false);
+
+        if (unit.size() >= static_cast<int>(sizeof(header))) {
+            memcpy(&header, unit.constData(), sizeof(header));
+            if (header.version == PHONON_VLC_STREAM_UNIT_VERSION
+                    && header.size >= sizeof(header) && header.size <= unit.size()) {
+                break;
+            }
+        }
+        warning() << "Dropping access unit without valid header," << unit.size() << "bytes";
+    }
+
+    *pts = header.pts;
+    // imem takes a negative dts as invalid rather than falling back to the pts.
+    *dts = header.dts < 0 ? header.pts : header.dts;
+    // imem (as of libVLC 2.2) does not pass these on, but let it have them.
+    *flags = header.flags;
+
+    const int size = unit.size() - header.size;
+    m_bytesRead.fetchAndAddRelaxed(size);
+    // The queued array keeps the data alive until imem releases it.
+    *buffer = const_cast<char *>(unit.constData()) + header.size;
+    *bufferSize = static_cast<size_t>(size);
+    m_unitsInFlight.insert(*buffer, unit);
+    return 0;
 }
 
 bool StreamReader::read(quint64 pos, int *length, char *buffer)
 {
-    QMutexLocker lock(&m_mutex);
-    DEBUG_BLOCK;
-    bool ret = true;
+    int done = 0;
+    while (done < *length) {
+        int size = *length - done;
+        const char *data = 0;
+        StreamBlock *block = 0;
+        if (!readBlock(pos + done, &size, &data, &block)) {
+            if (done == 0) {
+                return false;
+            }
+            break;
+        }
+        if (!block) {
+            break;
+        }
+        memcpy(buffer + done, data, size);
+        block->deref();
+        done += size;
+    }
+    *length = done;
+    return true;
+}
 
-    if (m_unlocked) {
-        return ret;
+bool StreamReader::readBlock(quint64 pos, int *length, const char **data, StreamBlock **block)
+{
+    *data = 0;
+    *block = 0;
+    m_stalled = false;
+
+    if (m_cache.capacity() != m_cacheSize.loadAcquire()) {
+        m_cache.setCapacity(m_cacheSize.loadAcquire());
+    }
+    if (m_spill.memoryLimit() != m_spillLimit.loadAcquire()) {
+        m_spill.setMemoryLimit(m_spillLimit.loadAcquire());
+        if (!m_spill.memoryLimit()) {
+            m_spill.clear();
+        }
     }
 
     if (currentPos() != pos) {
@@ -149,53 +405,498 @@ bool StreamReader::read(quint64 pos, int *length, char *buffer)
         setCurrentPos(pos);
     }
 
-    if (m_buffer.capacity() < *length) {
-        m_buffer.reserve(*length);
+    while (m_pos != m_bufferPos) {
+        int cached = *length;
+        if (m_pos < m_bufferPos) {
+            cached = static_cast<int>(qMin<quint64>(cached, m_bufferPos - m_pos));
+        }
+        cached = readCached(cached, data, block);
+        if (cached > 0) {
+            *length = cached;
+            m_pos += cached;
+            m_bytesRead.fetchAndAddRelaxed(cached);
+            return true;
+        }
+
+        if (m_pos < m_bufferPos) {
+            // Evicted since we decided to serve this from the cache, back to
+            // the producer then.
+            QMutexLocker lock(&m_mutex);
+            restartAt(m_pos);
+            break;
+        }
+
+        // A short forward seek, drop what lies in between as it comes in.
+        // Never wait for more than read-ahead buffers before taking a break.
+        quint64 maximumGap = m_buffer.capacity() / 2;
+        if (m_highWatermark.loadAcquire()) {
+            maximumGap = qMin<quint64>(maximumGap, m_highWatermark.loadAcquire());
+        }
+        int gap = static_cast<int>(qMin<quint64>(m_pos - m_bufferPos, maximumGap));
+        if (!waitForData(&gap)) {
+            return false;
+        }
+        if (gap == 0) {
+            *length = 0;
+            return true;
+        }
+        takeBuffered(gap, 0, 0);
     }
 
-    while (currentBufferSize() < static_cast<unsigned int>(*length)) {
-        quint64 oldSize = currentBufferSize();
-        needData();
+    if (!waitForData(length)) {
+        return false;
+    }
 
-        m_waitingForData.wait(&m_mutex);
+    *length = takeBuffered(*length, data, block);
+    m_bytesRead.fetchAndAddRelaxed(*length);
+    return true;
+}
 
-        if (oldSize == currentBufferSize()) {
-            if (m_eos && m_buffer.isEmpty()) {
-                return false;
+int StreamReader::takeBuffered(int length, const char **data, StreamBlock **block)
+{
+    const char *chunkData = 0;
+    StreamBlock *chunk = 0;
+    int taken = 0;
+    while (taken < length) {
+        const int size = m_buffer.peek(length - taken, &chunkData, &chunk);
+        if (!chunk) {
+            break;
+        }
+        if (streamSeekable()) {
+            cacheRange(m_bufferPos, chunk, chunkData, size);
+        }
+        if (data) {
+            // Keep the block alive for the caller once the ring moves on.
+            chunk->ref();
+            *data = chunkData;
+            *block = chunk;
+        }
+        m_buffer.skip(size);
+        m_bufferPos += size;
+        taken += size;
+        if (data) {
+            // Handing out never spans two blocks.
+            break;
+        }
+    }
+
+    if (m_pos < m_bufferPos) {
+        m_pos = m_bufferPos;
+    }
+    consumed();
+    return taken;
+}
+
+void StreamReader::cacheRange(quint64 pos, StreamBlock *block, const char *data, int length)
+{
+    m_cache.insert(pos, block, data, length);
+    if (m_spill.memoryLimit() && m_spill.contiguousEnd(pos) < pos + length) {
+        m_spill.write(pos, data, length);
+    }
+}
+
+int StreamReader::readCached(int length, const char **data, StreamBlock **block)
+{
+    int cached = m_cache.find(m_pos, data, block);
+    if (cached > 0) {
+        (*block)->ref();
+        return qMin(length, cached);
+    }
+
+    if (!m_spill.memoryLimit() || m_spill.contiguousEnd(m_pos) == m_pos) {
+        return 0;
+    }
+
+    // One copy out of the page cache is still a lot cheaper than going back
+    // to the producer.
+    StreamBlock *spilled = m_pool->acquire();
+    cached = m_spill.read(m_pos, spilled->data(), qMin(length, spilled->size()));
+    if (cached <= 0) {
+        spilled->deref();
+        return 0;
+    }
+    m_cache.insert(m_pos, spilled, spilled->data(), cached);
+    *data = spilled->data();
+    *block = spilled;
+    return cached;
+}
+
+quint64 StreamReader::cachedEnd(quint64 pos) const
+{
+    // The two may well cover alternating parts of one run.
+    quint64 end = pos;
+    forever {
+        const quint64 next = m_spill.contiguousEnd(m_cache.contiguousEnd(end));
+        if (next == end) {
+            return end;
+        }
+        end = next;
+    }
+}
+
+void StreamReader::restartAt(quint64 pos)
+{
+    // Whatever we got so far is still good for later seeks.
+    const char *chunkData = 0;
+    StreamBlock *chunk = 0;
+    int size;
+    while (streamSeekable() && (size = m_buffer.peek(m_buffer.bytesAvailable(), &chunkData, &chunk)) > 0) {
+        cacheRange(m_bufferPos, chunk, chunkData, size);
+        m_buffer.skip(size);
+        m_bufferPos += size;
+    }
+
+    m_buffer.clear();
+    m_overflow.clear();
+    m_overflowOffset = 0;
+    m_overflowSize.fetchAndStoreOrdered(0);
+    m_bufferPos = pos;
+    m_eos = false;
+    // The next read starts requesting again.
+    m_requesting.storeRelease(0);
+
+    // Do not touch m_size here, it reflects the size of the stream not the size of the buffer,
+    // and generally seeking does not change the size!
+
+    m_seeks.ref();
+    seekStream(pos);
+}
+
+bool StreamReader::waitForData(int *length)
+{
+    const int wanted = *length;
+    if (m_overflowSize.loadAcquire() || m_buffer.bytesAvailable() < wanted) {
+        QMutexLocker lock(&m_mutex);
+        drainOverflow();
+        while (m_buffer.bytesAvailable() < wanted) {
+            if (m_unlocked) {
+                m_waitingFor.fetchAndStoreOrdered(0);
+                *length = 0;
+                return true;
+            }
+            if (m_eos) {
+                if (m_buffer.bytesAvailable() == 0) {
+                    m_waitingFor.fetchAndStoreOrdered(0);
+                    return false;
+                }
+                break;
+            }
+
+            // Announce what we are waiting for before checking once more,
+            // writeData() only wakes us up once that much is buffered.
+            m_waitingFor.fetchAndStoreOrdered(wanted);
+            if (m_buffer.bytesAvailable() >= wanted) {
+                break;
+            }
+
+            const int oldSize = m_buffer.bytesAvailable();
+            m_stalled = true;
+            m_requesting.storeRelease(1);
+            requestData();
+            QElapsedTimer waited;
+            waited.start();
+            m_waitingForData.wait(&m_mutex);
+            m_waits.ref();
+            m_waitTime.fetchAndAddRelaxed(waited.nsecsElapsed() / 1000);
+            drainOverflow();
+
+            if (oldSize == m_buffer.bytesAvailable() && !m_unlocked && !m_eos) {
+                // We didn't get any more data.
+                // If we have some data to return, why tell to reader that we failed?
+                // Remember that length argument is more like maxSize not requiredSize
+                break;
             }
-            // We didn't get any more data
-            *length = static_cast<int>(oldSize);
-            // If we have some data to return, why tell to reader that we failed?
-            // Remember that length argument is more like maxSize not requiredSize
-            ret = true;
         }
+        m_waitingFor.fetchAndStoreOrdered(0);
     }
 
-    if (m_mediaObject->state() != Phonon::BufferingState &&
-        m_mediaObject->state() != Phonon::LoadingState) {
+    if (!m_highWatermark.loadAcquire()) {
+        // No read-ahead, so the producer only ever needs to fill this read.
         enoughData();
     }
 
-    memcpy(buffer, m_buffer.data(), *length);
-    m_pos += *length;
-    // trim the buffer by the amount read
-    m_buffer = m_buffer.mid(*length);
+    return true;
+}
+
+void StreamReader::consumed()
+{
+    if (m_overflowSize.loadAcquire()) {
+        // We made room, so move over what did not fit before.
+        QMutexLocker lock(&m_mutex);
+        drainOverflow();
+    }
+
+    updateReadAhead(false);
+}
+
+void StreamReader::setWatermarks(int low, int high)
+{
+    high = qBound(0, high, m_buffer.capacity());
+    low = qBound(0, low, high);
+    m_lowWatermark.storeRelease(low);
+    m_highWatermark.storeRelease(high);
+}
+
+int StreamReader::lowWatermark() const
+{
+    return m_lowWatermark.loadAcquire();
+}
+
+int StreamReader::highWatermark() const
+{
+    return m_highWatermark.loadAcquire();
+}
+
+void StreamReader::updateReadAhead(bool written)
+{
+    const int high = m_highWatermark.loadAcquire();
+    if (!high) {
+        return;
+    }
+
+    const quint64 fill = currentBufferSize();
+    if (fill >= static_cast<quint64>(high)) {
+        // A waiting reader still needs more, see wakeReader().
+        if (!m_waitingFor.loadAcquire() && m_requesting.testAndSetOrdered(1, 0)) {
+            enoughData();
+        }
+    } else if (fill < static_cast<quint64>(m_lowWatermark.loadAcquire())) {
+        if (m_requesting.testAndSetOrdered(0, 1)) {
+            requestData();
+            return;
+        }
+    }
+
+    // needData() is a one-shot request, a pull stream writes once and then
+    // waits for the next one. Keep asking until we are above the high mark,
+    // unless wakeReader() already did for a waiting reader.
+    if (written && fill < static_cast<quint64>(high) && m_requesting.loadAcquire()
+            && !m_waitingFor.loadAcquire()) {
+        requestData();
+    }
+}
+
+int StreamReader::readSize() const
+{
+    return m_readSize.loadAcquire();
+}
+
+int StreamReader::readSizeMinimum() const
+{
+    return m_readSizeMinimum.loadAcquire();
+}
+
+int StreamReader::readSizeMaximum() const
+{
+    return m_readSizeMaximum.loadAcquire();
+}
 
-    return ret;
+void StreamReader::setReadSizeBounds(int minimum, int maximum)
+{
+    maximum = qBound(1, maximum, CHUNKSIZE);
+    minimum = qBound(1, minimum, maximum);
+    m_readSizeMinimum.storeRelease(minimum);
+    m_readSizeMaximum.storeRelease(maximum);
+    m_readSize.storeRelease(qBound(minimum, readSize(), maximum));
+}
+
+void StreamReader::adaptReadSize(int length, bool stalled)
+{
+    if (!m_rateTimer.isValid()) {
+        m_rateTimer.start();
+    }
+    m_windowBytes += length;
+    if (stalled) {
+        ++m_windowStalls;
+    }
+
+    const qint64 elapsed = m_rateTimer.elapsed();
+    if (elapsed < READSIZE_WINDOW) {
+        return;
+    }
+
+    // Aim for a fixed number of reads per second at the observed rate, but
+    // never move by more than a factor of two per window so that a single
+    // burst (e.g. VLC filling its own cache) does not throw us off.
+    const int current = readSize();
+    const qint64 rate = m_windowBytes * 1000 / elapsed;
+    qint64 target = qBound(qint64(current / 2), rate / READS_PER_SECOND, qint64(current) * 2);
+    if (m_windowStalls > 0) {
+        // Reads had to wait for the producer, asking for less makes us return
+        // as soon as there is something to decode.
+        target = qMin(target, qint64(current / 2));
+    }
+    m_readSize.storeRelease(qBound(readSizeMinimum(), int(target), readSizeMaximum()));
+
+    m_windowBytes = 0;
+    m_windowStalls = 0;
+    m_rateTimer.restart();
+}
+
+StreamReader::Statistics StreamReader::statistics() const
+{
+    Statistics statistics;
+    statistics.bytesWritten = m_bytesWritten.loadAcquire();
+    statistics.bytesRead = m_bytesRead.loadAcquire();
+    statistics.needDataCalls = m_needDataCalls.loadAcquire();
+    statistics.waits = m_waits.loadAcquire();
+    statistics.waitTime = m_waitTime.loadAcquire();
+    statistics.seeks = m_seeks.loadAcquire();
+    statistics.bufferFill = currentBufferSize();
+    return statistics;
 }
 
 void StreamReader::endOfData()
 {
+    QMutexLocker lock(&m_mutex);
     m_eos = true;
     m_waitingForData.wakeAll();
 }
 
 void StreamReader::writeData(const QByteArray &data)
 {
+    m_bytesWritten.fetchAndAddRelaxed(data.size());
+    if (isElementaryStream()) {
+        // Access units come at a few dozen per second, no point in being clever.
+        QMutexLocker lock(&m_mutex);
+        m_units.enqueue(data);
+        m_unitBytes.fetchAndAddOrdered(data.size());
+        m_waitingForData.wakeAll();
+        lock.unlock();
+        updateReadAhead(true);
+        return;
+    }
+
+    int written = 0;
+    if (!m_overflowSize.loadAcquire()) {
+        // Fast path, the ring buffer is ours alone.
+        written = m_buffer.write(data.constData(), data.size());
+        if (written == data.size()) {
+            wakeReader();
+            updateReadAhead(true);
+            return;
+        }
+    }
+
     QMutexLocker lock(&m_mutex);
-    DEBUG_BLOCK;
-    m_buffer.append(data);
-    m_waitingForData.wakeAll();
+    enqueueOverflow(data, written);
+    drainOverflow();
+    wakeReaderLocked();
+    lock.unlock();
+    updateReadAhead(true);
+}
+
+void StreamReader::writeData(const QList<QByteArray> &segments)
+{
+    qint64 size = 0;
+    foreach (const QByteArray &segment, segments) {
+        size += segment.size();
+    }
+    m_bytesWritten.fetchAndAddRelaxed(size);
+
+    if (isElementaryStream()) {
+        QMutexLocker lock(&m_mutex);
+        foreach (const QByteArray &segment, segments) {
+            m_units.enqueue(segment);
+        }
+        m_unitBytes.fetchAndAddOrdered(size);
+        m_waitingForData.wakeAll();
+        lock.unlock();
+        updateReadAhead(true);
+        return;
+    }
+
+    int first = 0;
+    int written = 0;
+    if (!m_overflowSize.loadAcquire()) {
+        for (; first < segments.size(); ++first) {
+            const QByteArray &segment = segments.at(first);
+            written = m_buffer.write(segment.constData(), segment.size());
+            if (written < segment.size()) {
+                break;
+            }
+        }
+        if (first == segments.size()) {
+            wakeReader();
+            updateReadAhead(true);
+            return;
+        }
+    }
+
+    QMutexLocker lock(&m_mutex);
+    enqueueOverflow(segments.at(first), written);
+    for (++first; first < segments.size(); ++first) {
+        enqueueOverflow(segments.at(first), 0);
+    }
+    drainOverflow();
+    wakeReaderLocked();
+    lock.unlock();
+    updateReadAhead(true);
+}
+
+void StreamReader::enqueueOverflow(const QByteArray &data, int offset)
+{
+    if (m_overflow.isEmpty()) {
+        m_overflowOffset = offset;
+    }
+    m_overflow.enqueue(data);
+    m_overflowSize.fetchAndAddOrdered(data.size() - offset);
+}
+
+void StreamReader::requestData()
+{
+    m_needDataCalls.ref();
+    needData();
+}
+
+void StreamReader::wakeReader()
+{
+    // Pairs with the ordered store in read(): either we see what the reader
+    // is waiting for, or the reader sees our data before going to sleep.
+    const int waitingFor = m_waitingFor.loadAcquire();
+    if (!waitingFor) {
+        return;
+    }
+    if (m_buffer.bytesAvailable() >= waitingFor) {
+        QMutexLocker lock(&m_mutex);
+        m_waitingForData.wakeAll();
+        return;
+    }
+    // A pull stream writes once per needData(), possibly less than the
+    // reader waits for. Keep asking or it never gets there.
+    requestData();
+}
+
+void StreamReader::wakeReaderLocked()
+{
+    const int waitingFor = m_waitingFor.loadAcquire();
+    if (!waitingFor) {
+        return;
+    }
+    if (m_buffer.bytesAvailable() >= waitingFor) {
+        m_waitingForData.wakeAll();
+        return;
+    }
+    requestData();
+}
+
+void StreamReader::drainOverflow()
+{
+    // Whoever holds the mutex while there is overflow is the only one writing
+    // into the ring buffer, writeData() takes the lock-free path only when
+    // there is none.
+    while (!m_overflow.isEmpty()) {
+        const QByteArray &head = m_overflow.head();
+        const int remaining = head.size() - m_overflowOffset;
+        const int written = m_buffer.write(head.constData() + m_overflowOffset, remaining);
+        m_overflowSize.fetchAndAddOrdered(-written);
+        if (written < remaining) {
+            m_overflowOffset += written;
+            return;
+        }
+        m_overflow.dequeue();
+        m_overflowOffset = 0;
+    }
 }
 
 quint64 StreamReader::currentPos() const
@@ -207,12 +908,54 @@ void StreamReader::setCurrentPos(qint64 pos)
 {
     QMutexLocker lock(&m_mutex);
     m_pos = pos;
-    m_buffer.clear(); // Not optimal, but meh
 
-    // Do not touch m_size here, it reflects the size of the stream not the size of the buffer,
-    // and generally seeking does not change the size!
+    // Anything from the start of the buffer up to a bit ahead of what the
+    // producer sent so far is on its way anyway, the read path skips to it.
+    const quint64 bufferEnd = m_bufferPos + currentBufferSize();
+    if (m_pos >= m_bufferPos && m_pos <= bufferEnd + SHORTSEEK) {
+        return;
+    }
 
-    seekStream(pos);
+    // When we have the data cached, the producer only needs to continue
+    // where the cached data ends.
+    const quint64 end = cachedEnd(m_pos);
+    if (end > m_pos) {
+        if (end >= m_bufferPos && end <= bufferEnd + SHORTSEEK) {
+            return;
+        }
+        restartAt(end);
+        return;
+    }
+
+    restartAt(m_pos);
+}
+
+int StreamReader::cacheSize() const
+{
+    return m_cacheSize.loadAcquire();
+}
+
+void StreamReader::setCacheSize(int size)
+{
+    // The cache belongs to the reading thread, it picks this up on its next read.
+    m_cacheSize.storeRelease(qMax(0, size));
+}
+
+int StreamReader::spillMemoryLimit() const
+{
+    return m_spillLimit.loadAcquire();
+}
+
+void StreamReader::setSpillMemoryLimit(int limit)
+{
+    // At least one window has to fit, anything less could not be honoured.
+    if (limit > 0 && limit < StreamSpillFile::windowSize()) {
+        warning() << "Spill memory limit" << limit << "is below the minimum of"
+                  << StreamSpillFile::windowSize() << "bytes, ignoring it";
+        return;
+    }
+    // Same as for the cache, the reading thread applies it.
+    m_spillLimit.storeRelease(qMax(0, limit));
 }
 
 void StreamReader::setStreamSize(qint64 newSize)
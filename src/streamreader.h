@@ -25,10 +25,24 @@
 #include <phonon/streaminterface.h>
 
 #include <stdint.h>
+#include <sys/types.h>
 
+#include <vlc/libvlc_version.h>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QList>
 #include <QtCore/QMutex>
+#include <QtCore/QQueue>
+#include <QtCore/QStringList>
 #include <QtCore/QWaitCondition>
 
+#include "streamrangecache.h"
+#include "streamringbuffer.h"
+#include "streamspillfile.h"
+
 #ifndef QT_NO_PHONON_ABSTRACTMEDIASTREAM
 
 namespace Phonon
@@ -41,6 +55,8 @@ namespace VLC
 
 class Media;
 class MediaObject;
+class StreamBlock;
+class StreamBlockPool;
 
 /** \brief Class for supporting custom data streams to the backend
  *
@@ -62,8 +78,35 @@ public:
     explicit StreamReader(MediaObject *parent);
     ~StreamReader();
 
+    /**
+     * Creates the Media reading from this stream. With libVLC 3 this uses
+     * libvlc_media_new_callbacks(), where libVLC reads straight into its own
+     * buffers. Older versions go through the imem access, see addToMedia().
+     */
+    Media *createMedia(QObject *parent);
+
     void addToMedia(Media *media);
 
+    /**
+     * Switches to elementary stream mode if \p stream carries a dynamic
+     * "vlc-es-category" property ("audio", "video" or "subtitle"). In this
+     * mode every writeData() is one demuxed access unit prefixed by a
+     * PhononVlcStreamUnitHeader, see the installed streamunitheader.h for the
+     * layout. libVLC takes the units straight to the decoder without probing
+     * or demuxing anything.
+     *
+     * All other "vlc-es-*" properties are passed on as the matching imem
+     * option, at least "vlc-es-codec" (a fourcc like "h264" or "mp4a") must
+     * be set. Video usually wants "vlc-es-width", "vlc-es-height" and
+     * "vlc-es-fps", audio "vlc-es-channels" and "vlc-es-samplerate".
+     *
+     * Must be called before playback starts.
+     */
+    void loadElementaryStreamFormat(const QObject *stream);
+
+    /// \returns whether the stream is read as an elementary stream
+    bool isElementaryStream() const { return m_esCategory != 0; }
+
     void lock();
     void unlock();
 
@@ -76,8 +119,21 @@ public:
 
     static int seekCallback(void *data, const uint64_t pos);
 
+#if (LIBVLC_VERSION_INT >= LIBVLC_VERSION(3, 0, 0, 0))
+    static int openCallback(void *data, void **opaque, uint64_t *size);
+    static ssize_t readIntoCallback(void *data, unsigned char *buffer, size_t length);
+    static void closeCallback(void *data);
+#endif
+
     quint64 currentBufferSize() const;
     void writeData(const QByteArray &data);
+
+    /**
+     * Appends all of \p segments at once, e.g. whatever a socket had to
+     * offer. This takes the lock and wakes the reader at most once for the
+     * whole batch instead of once per segment.
+     */
+    void writeData(const QList<QByteArray> &segments);
     quint64 currentPos() const;
     void setCurrentPos(qint64 pos);
 
@@ -92,6 +148,91 @@ public:
      */
     bool read(quint64 offset, int *length, char *buffer);
 
+    /**
+     * Like read(), but instead of copying the data it points \p data at the
+     * buffered data directly. The returned \p block holds a reference the
+     * caller needs to drop once it is done with \p data.
+     *
+     * The data handed out never spans two blocks, so \p length may be
+     * shorter than what read() would have returned.
+     */
+    bool readBlock(quint64 offset, int *length, const char **data, StreamBlock **block);
+
+    /**
+     * \returns the number of bytes readCallback() currently hands to libVLC
+     * per call. It adapts to the consumption rate of the stream and to how
+     * often reads had to wait for data, within readSizeMinimum() and
+     * readSizeMaximum().
+     */
+    int readSize() const;
+    int readSizeMinimum() const;
+    int readSizeMaximum() const;
+
+    /**
+     * Sets the bounds for the adaptive read size. Small reads keep the startup
+     * latency low on slow streams, large reads cut the per-call overhead on
+     * fast ones. The maximum is limited to the ring buffer's chunk size.
+     */
+    void setReadSizeBounds(int minimum, int maximum);
+
+    /**
+     * Sets the read-ahead watermarks in bytes. Whenever the buffer drops below
+     * \p low the producer is asked for data until the buffer holds at least
+     * \p high bytes, then it is told it may take a break with enoughData().
+     * This way libVLC reads should hardly ever have to wait for the producer.
+     *
+     * A \p high of 0 disables read-ahead, data is then only requested when a
+     * read cannot be satisfied from the buffer. Either way a read waiting for
+     * data keeps asking until it got what it needs.
+     */
+    void setWatermarks(int low, int high);
+    int lowWatermark() const;
+    int highWatermark() const;
+
+    /**
+     * Ranges of a seekable stream that were already read are kept around in
+     * a cache of \p size bytes, so backward seeks and seeks into ranges read
+     * before (e.g. demuxers probing an index at the end of the stream) do not
+     * have to go back to the producer. 0 disables the cache.
+     */
+    void setCacheSize(int size);
+    int cacheSize() const;
+
+    /**
+     * Enables spilling everything read from a seekable stream to a sparse
+     * temporary file, so the whole stream stays available for seeking without
+     * holding it in memory. \p limit is the number of bytes of the file mapped
+     * at once, on top of cacheSize(); 0 disables spilling (the default).
+     * Limits below StreamSpillFile::windowSize() (1 MiB) are ignored with a
+     * warning.
+     */
+    void setSpillMemoryLimit(int limit);
+    int spillMemoryLimit() const;
+
+    /// Snapshot of the counters kept by the reader, see statistics().
+    struct Statistics {
+        /// Bytes the producer handed us with writeData().
+        qint64 bytesWritten;
+        /// Bytes handed to libVLC.
+        qint64 bytesRead;
+        /// Number of needData() requests sent to the producer.
+        int needDataCalls;
+        /// Number of times a read had to block waiting for the producer.
+        int waits;
+        /// Total time reads spent blocked, in microseconds.
+        qint64 waitTime;
+        /// Number of seekStream() requests sent to the producer.
+        int seeks;
+        /// Bytes currently buffered, see currentBufferSize().
+        qint64 bufferFill;
+    };
+
+    /**
+     * \returns the current counters. They are plain atomics updated on the
+     * way, so this is cheap and may be called from any thread at any time.
+     */
+    Statistics statistics() const;
+
     void endOfData();
     void setStreamSize(qint64 newSize);
     qint64 streamSize() const;
@@ -102,15 +243,156 @@ signals:
     void streamSeekableChanged(bool seekable);
 
 protected:
-    QByteArray m_buffer;
+    /**
+     * Blocks until \p length bytes are buffered, the stream ended or the
+     * reader got unlocked. On return \p length is 0 if the reader got unlocked.
+     *
+     * \returns \c false if nothing can be read anymore
+     */
+    bool waitForData(int *length);
+
+    /**
+     * Takes up to \p length bytes out of m_buffer, adding them to the cache.
+     * If \p data is set, only the data within one block is taken and handed
+     * out through \p data and \p block, with a reference taken for the caller.
+     *
+     * \returns number of bytes taken
+     */
+    int takeBuffered(int length, const char **data, StreamBlock **block);
+
+    /// Keeps the overflow and read-ahead going after data got taken out of m_buffer.
+    void consumed();
+
+    /// Adds data taken out of m_buffer to the cache and the spill file.
+    void cacheRange(quint64 pos, StreamBlock *block, const char *data, int length);
+
+    /**
+     * Looks up m_pos in the cache and then the spill file. Data only found in
+     * the spill file is read back into a fresh block, which also goes into
+     * the cache. Arguments and result as for readBlock().
+     */
+    int readCached(int length, const char **data, StreamBlock **block);
+
+    /// \returns the end of the data cached or spilled contiguously from \p pos
+    quint64 cachedEnd(quint64 pos) const;
+
+    /**
+     * Drops the buffer, moving its data into the cache, and makes the producer
+     * continue at \p pos. Must be called with m_mutex locked.
+     */
+    void restartAt(quint64 pos);
+
+    /**
+     * Feeds a completed readCallback() into the read size estimation.
+     * \param stalled whether the read had to wait for the producer
+     */
+    void adaptReadSize(int length, bool stalled);
+
+    /**
+     * Requests data or tells the producer to take a break depending on the
+     * buffer fill level. Called from both the reader and the writer.
+     * \param written whether this is called after the producer wrote data
+     */
+    void updateReadAhead(bool written);
+
+    /// needData(), counted.
+    void requestData();
+
+    /**
+     * readCallback() in elementary stream mode: blocks until the next access
+     * unit is there and hands it out with its timestamps.
+     */
+    int readUnit(int64_t *dts, int64_t *pts, unsigned *flags, // krazy:exclude=typedefs
+                 size_t *bufferSize, void **buffer);
+
+    /**
+     * Wakes the reader if it waits for no more than what is buffered by now,
+     * otherwise asks the producer for more on its behalf.
+     */
+    void wakeReader();
+
+    /// Same as wakeReader(), but with m_mutex already locked.
+    void wakeReaderLocked();
+
+    /**
+     * Queues \p data, of which the first \p offset bytes already went into
+     * the ring buffer. Must be called with m_mutex locked.
+     */
+    void enqueueOverflow(const QByteArray &data, int offset);
+
+    /**
+     * Moves data that did not fit into the ring buffer over, as far as there
+     * is space. Must be called with m_mutex locked.
+     */
+    void drainOverflow();
+
+    StreamBlockPool *m_pool;
+    StreamRingBuffer m_buffer;
+    /// Blocks handed to imem by readCallback(), keyed by the pointer we gave out.
+    QHash<void *, StreamBlock *> m_blocksInFlight;
+    StreamRangeCache m_cache;
+    /// Capacity for m_cache as requested through setCacheSize().
+    QAtomicInt m_cacheSize;
+    StreamSpillFile m_spill;
+    /// Memory limit for m_spill as requested through setSpillMemoryLimit().
+    QAtomicInt m_spillLimit;
+    /// Position of the reader in the stream.
     quint64 m_pos;
+    /**
+     * Position of the first byte in m_buffer. Differs from m_pos while the
+     * reader is served from m_cache or skips ahead after a short seek.
+     */
+    quint64 m_bufferPos;
     quint64 m_size;
     bool m_eos;
     bool m_seekable;
     bool m_unlocked;
     QMutex m_mutex;
     QWaitCondition m_waitingForData;
-    MediaObject *m_mediaObject;
+    /// Bytes read() is blocked on, 0 when it is not waiting.
+    QAtomicInt m_waitingFor;
+    /// Whether the last waitForData() had to wait, only used by the reader.
+    bool m_stalled;
+
+    QAtomicInt m_readSize;
+    QAtomicInt m_readSizeMinimum;
+    QAtomicInt m_readSizeMaximum;
+    /// Measurement window of adaptReadSize(), only used by the reader.
+    QElapsedTimer m_rateTimer;
+    qint64 m_windowBytes;
+    int m_windowStalls;
+    /**
+     * Data written while the ring buffer was full. writeData() must never
+     * block the producer, so this queues (shared, not copied) arrays until
+     * the reader made room. Guarded by m_mutex.
+     */
+    QQueue<QByteArray> m_overflow;
+    int m_overflowOffset;
+    /// Bytes in m_overflow, readable without locking.
+    QAtomicInt m_overflowSize;
+
+    QAtomicInt m_lowWatermark;
+    QAtomicInt m_highWatermark;
+    /// Whether we asked for data and did not call enoughData() since.
+    QAtomicInt m_requesting;
+
+    /// imem category in elementary stream mode, 0 for a plain byte stream.
+    int m_esCategory;
+    /// imem options describing the elementary stream.
+    QStringList m_esOptions;
+    /// Access units not read yet, guarded by m_mutex.
+    QQueue<QByteArray> m_units;
+    /// Bytes in m_units, readable without locking.
+    QAtomicInt m_unitBytes;
+    /// Access units handed to imem, keyed by the pointer we gave out.
+    QHash<void *, QByteArray> m_unitsInFlight;
+
+    QAtomicInteger<qint64> m_bytesWritten;
+    QAtomicInteger<qint64> m_bytesRead;
+    QAtomicInt m_needDataCalls;
+    QAtomicInt m_waits;
+    QAtomicInteger<qint64> m_waitTime;
+    QAtomicInt m_seeks;
 };
 
 }
@@ -0,0 +1,159 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "streamringbuffer.h"
+
+#include <string.h>
+
+#include "streamblock.h"
+
+namespace Phonon {
+namespace VLC {
+
+static int roundUpToPowerOfTwo(int value, int *shift)
+{
+    int result = 1;
+    *shift = 0;
+    while (result < value) {
+        result <<= 1;
+        ++*shift;
+    }
+    return result;
+}
+
+StreamRingBuffer::StreamRingBuffer(StreamBlockPool *pool, int chunkCount)
+    : m_pool(pool)
+    , m_writePosition(0)
+    , m_readPosition(0)
+{
+    int unused;
+    m_chunkSize = roundUpToPowerOfTwo(pool->blockSize(), &m_chunkShift);
+    Q_ASSERT(m_chunkSize == pool->blockSize());
+    const int count = roundUpToPowerOfTwo(chunkCount, &unused);
+    // The wrapping counters only work while the capacity fits into 31 bits.
+    Q_ASSERT(qint64(m_chunkSize) * count <= (Q_INT64_C(1) << 30));
+    m_chunkMask = count - 1;
+    m_chunks.fill(0, count);
+}
+
+StreamRingBuffer::~StreamRingBuffer()
+{
+    for (int i = 0; i < m_chunks.size(); ++i) {
+        if (m_chunks.at(i))
+            m_chunks.at(i)->deref();
+    }
+}
+
+int StreamRingBuffer::bytesAvailable() const
+{
+    const quint32 write = m_writePosition.loadAcquire();
+    const quint32 read = m_readPosition.loadAcquire();
+    return static_cast<int>(write - read);
+}
+
+int StreamRingBuffer::freeSpace() const
+{
+    // The producer never enters the chunk the consumer is in, the consumer
+    // may still be handing out what is left of it from the previous round.
+    const quint32 write = m_writePosition.loadAcquire();
+    const quint32 read = m_readPosition.loadAcquire();
+    const quint32 limit = (read & ~quint32(m_chunkSize - 1)) + capacity();
+    return static_cast<int>(limit - write);
+}
+
+int StreamRingBuffer::write(const char *data, int size)
+{
+    quint32 position = m_writePosition.load();
+    const int toWrite = qMin(size, freeSpace());
+
+    StreamBlock **chunks = m_chunks.data();
+    int written = 0;
+    while (written < toWrite) {
+        StreamBlock *&chunk = chunks[(position >> m_chunkShift) & m_chunkMask];
+        const int offset = offsetIn(position);
+        // Everything in this chunk from its last round is consumed by now and
+        // the consumer took its references before moving on (see freeSpace()),
+        // but the cache or imem might still hold on to it. Never write into that.
+        if (!chunk || (offset == 0 && chunk->isShared())) {
+            if (chunk)
+                chunk->deref();
+            chunk = m_pool->acquire();
+        }
+        const int length = qMin(toWrite - written, m_chunkSize - offset);
+        memcpy(chunk->data() + offset, data + written, length);
+        written += length;
+        position += length;
+    }
+
+    // Ordered so that the consumer sees the data before the new position and
+    // so that a following check of the reader's wait state cannot be
+    // reordered before it (see StreamReader::writeData).
+    if (written)
+        m_writePosition.fetchAndAddOrdered(written);
+    return written;
+}
+
+int StreamRingBuffer::read(char *data, int size)
+{
+    quint32 position = m_readPosition.load();
+    const int toRead = qMin(size, bytesAvailable());
+
+    int done = 0;
+    while (done < toRead) {
+        const int offset = offsetIn(position);
+        const int length = qMin(toRead - done, m_chunkSize - offset);
+        memcpy(data + done, chunkAt(position)->data() + offset, length);
+        done += length;
+        position += length;
+    }
+
+    if (done)
+        m_readPosition.fetchAndAddOrdered(done);
+    return done;
+}
+
+int StreamRingBuffer::peek(int size, const char **data, StreamBlock **block) const
+{
+    const quint32 position = m_readPosition.load();
+    const int available = bytesAvailable();
+    if (available == 0 || size <= 0) {
+        *data = 0;
+        *block = 0;
+        return 0;
+    }
+
+    const int offset = offsetIn(position);
+    *block = chunkAt(position);
+    *data = (*block)->data() + offset;
+    return qMin(qMin(size, available), m_chunkSize - offset);
+}
+
+int StreamRingBuffer::skip(int size)
+{
+    const int toSkip = qMin(size, bytesAvailable());
+    if (toSkip)
+        m_readPosition.fetchAndAddOrdered(toSkip);
+    return toSkip;
+}
+
+void StreamRingBuffer::clear()
+{
+    m_readPosition.fetchAndStoreOrdered(m_writePosition.loadAcquire());
+}
+
+} // namespace VLC
+} // namespace Phonon
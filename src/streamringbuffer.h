@@ -0,0 +1,126 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_VLC_STREAMRINGBUFFER_H
+#define PHONON_VLC_STREAMRINGBUFFER_H
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QVector>
+
+namespace Phonon {
+namespace VLC {
+
+class StreamBlock;
+class StreamBlockPool;
+
+/** \brief Bounded single-producer/single-consumer byte ring made of fixed-size chunks
+ *
+ * The producer appends with write(), the consumer takes data out with read()
+ * or skip(). Neither side ever moves data that is already in the buffer and
+ * neither side needs a lock, as long as there is exactly one producer thread
+ * and exactly one consumer thread.
+ *
+ * Chunks are StreamBlocks taken from a StreamBlockPool by the producer the
+ * first time they are touched, so a slow stream only costs as much memory as
+ * it actually buffers. The consumer may keep a reference to the block it is
+ * reading from (see peek()); when the producer comes around to a chunk that
+ * is still referenced it swaps in a fresh block instead of overwriting it.
+ * The producer never enters the chunk the consumer is in, so up to one chunk
+ * less than capacity() may be writable.
+ *
+ * Positions are kept as wrapping 32 bit counters, which is why chunk size and
+ * chunk count must both be powers of two.
+ */
+class StreamRingBuffer
+{
+public:
+    /**
+     * \param pool pool to take chunks from, its block size must be a power of two
+     * \param chunkCount number of chunks, rounded up to a power of two
+     */
+    explicit StreamRingBuffer(StreamBlockPool *pool, int chunkCount = 64);
+    ~StreamRingBuffer();
+
+    /// \returns the number of bytes that can be read right now
+    int bytesAvailable() const;
+
+    /// \returns the number of bytes that can be written right now
+    int freeSpace() const;
+
+    /// \returns total number of bytes the buffer can hold
+    int capacity() const { return m_chunkSize * m_chunks.size(); }
+
+    /**
+     * Producer side. Appends as much of \p data as fits.
+     * \returns number of bytes actually written
+     */
+    int write(const char *data, int size);
+
+    /**
+     * Consumer side. Copies up to \p size bytes into \p data and drops them
+     * from the buffer.
+     * \returns number of bytes actually read
+     */
+    int read(char *data, int size);
+
+    /**
+     * Consumer side. Looks at up to \p size bytes without consuming them.
+     * Only data within one chunk is returned, so the result may be shorter
+     * than what is available. To keep the data around after skipping it, take
+     * a reference on \p block before calling skip(), the producer checks for
+     * references only when it enters a chunk.
+     *
+     * \param data set to the first readable byte
+     * \param block set to the block containing \p data, 0 if nothing is available
+     * \returns number of contiguous bytes at \p data
+     */
+    int peek(int size, const char **data, StreamBlock **block) const;
+
+    /**
+     * Consumer side. Drops up to \p size bytes without copying them.
+     * \returns number of bytes actually skipped
+     */
+    int skip(int size);
+
+    /// Consumer side. Drops everything that is currently readable.
+    void clear();
+
+private:
+    Q_DISABLE_COPY(StreamRingBuffer)
+
+    inline StreamBlock *chunkAt(quint32 position) const
+    { return m_chunks.at((position >> m_chunkShift) & m_chunkMask); }
+
+    inline int offsetIn(quint32 position) const
+    { return position & (m_chunkSize - 1); }
+
+    StreamBlockPool *m_pool;
+    int m_chunkSize;
+    int m_chunkShift;
+    quint32 m_chunkMask;
+    QVector<StreamBlock *> m_chunks;
+
+    /// Total bytes ever written, only modified by the producer.
+    QAtomicInt m_writePosition;
+    /// Total bytes ever consumed, only modified by the consumer.
+    QAtomicInt m_readPosition;
+};
+
+} // namespace VLC
+} // namespace Phonon
+
+#endif // PHONON_VLC_STREAMRINGBUFFER_H
@@ -0,0 +1,216 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "streamspillfile.h"
+
+#include <QtCore/QDir>
+
+#include <string.h>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#endif
+
+#include "utils/debug.h"
+
+namespace Phonon {
+namespace VLC {
+
+// Size of one mapped window, a multiple of any sane page size.
+#define WINDOWSIZE (1024 * 1024)
+
+StreamSpillFile::StreamSpillFile(int memoryLimit)
+    : m_file(0)
+    , m_memoryLimit(memoryLimit)
+    , m_useCounter(0)
+    , m_failed(false)
+{
+}
+
+StreamSpillFile::~StreamSpillFile()
+{
+    clear();
+}
+
+int StreamSpillFile::windowSize()
+{
+    return WINDOWSIZE;
+}
+
+void StreamSpillFile::setMemoryLimit(int limit)
+{
+    Q_ASSERT(limit == 0 || limit >= WINDOWSIZE);
+    m_memoryLimit = limit;
+    unmapWindows(m_memoryLimit / WINDOWSIZE);
+}
+
+bool StreamSpillFile::write(quint64 pos, const char *data, int length)
+{
+    if (m_failed || length <= 0)
+        return false;
+
+    if (!m_file) {
+        m_file = new QTemporaryFile(QDir::tempPath() + QLatin1String("/phonon-vlc-stream-XXXXXX"));
+        if (!m_file->open()) {
+            warning() << "Failed to create stream spill file" << m_file->fileName();
+            delete m_file;
+            m_file = 0;
+            m_failed = true;
+            return false;
+        }
+    }
+
+    const quint64 end = pos + length;
+    int done = 0;
+    while (done < length) {
+        const quint64 position = pos + done;
+        uchar *base = window(position, true);
+        if (!base) {
+            m_failed = true;
+            return false;
+        }
+        const int offset = static_cast<int>(position % WINDOWSIZE);
+        const int size = qMin(length - done, WINDOWSIZE - offset);
+        memcpy(base + offset, data + done, size);
+        done += size;
+    }
+
+    addRange(pos, end);
+    return true;
+}
+
+int StreamSpillFile::read(quint64 pos, char *data, int length)
+{
+    const int available = static_cast<int>(qMin<quint64>(length, contiguousEnd(pos) - pos));
+    int done = 0;
+    while (done < available) {
+        const quint64 position = pos + done;
+        uchar *base = window(position, false);
+        if (!base)
+            break;
+        const int offset = static_cast<int>(position % WINDOWSIZE);
+        const int size = qMin(available - done, WINDOWSIZE - offset);
+        memcpy(data + done, base + offset, size);
+        done += size;
+    }
+    return done;
+}
+
+quint64 StreamSpillFile::contiguousEnd(quint64 pos) const
+{
+    // Ranges are merged on insertion, so there is at most one to look at.
+    QMap<quint64, quint64>::const_iterator it = m_ranges.upperBound(pos);
+    if (it == m_ranges.constBegin())
+        return pos;
+    --it;
+    return qMax(pos, it.value());
+}
+
+void StreamSpillFile::clear()
+{
+    unmapWindows(0);
+    m_ranges.clear();
+    delete m_file;
+    m_file = 0;
+    m_failed = false;
+}
+
+uchar *StreamSpillFile::window(quint64 pos, bool allocate)
+{
+    const quint64 index = pos / WINDOWSIZE;
+    QMap<quint64, Window>::iterator it = m_windows.find(index);
+    if (it != m_windows.end()) {
+        it.value().lastUse = ++m_useCounter;
+        return it.value().data;
+    }
+
+    const int maximumWindows = m_memoryLimit / WINDOWSIZE;
+    if (!m_file || !maximumWindows)
+        return 0;
+
+    unmapWindows(maximumWindows - 1);
+
+    // Storing into a mapped hole the file system has no room for raises
+    // SIGBUS, so make sure the window is backed before writing to it. Windows
+    // only get read where data was written before, those are backed already.
+    const qint64 start = static_cast<qint64>(index) * WINDOWSIZE;
+#ifdef Q_OS_UNIX
+    if (allocate) {
+        const int error = posix_fallocate(m_file->handle(), start, WINDOWSIZE);
+        if (error) {
+            warning() << "Failed to allocate stream spill file:" << strerror(error);
+            return 0;
+        }
+    }
+#else
+    Q_UNUSED(allocate);
+#endif
+    // Growing the file does not allocate anything, the holes between the
+    // windows stay sparse.
+    const qint64 end = start + WINDOWSIZE;
+    if (m_file->size() < end && !m_file->resize(end)) {
+        warning() << "Failed to grow stream spill file:" << m_file->errorString();
+        return 0;
+    }
+
+    uchar *data = m_file->map(start, WINDOWSIZE);
+    if (!data) {
+        warning() << "Failed to map stream spill file:" << m_file->errorString();
+        return 0;
+    }
+
+    Window window = { data, ++m_useCounter };
+    m_windows.insert(index, window);
+    return data;
+}
+
+void StreamSpillFile::unmapWindows(int keep)
+{
+    while (m_windows.size() > qMax(0, keep)) {
+        QMap<quint64, Window>::iterator oldest = m_windows.begin();
+        QMap<quint64, Window>::iterator it = oldest;
+        for (++it; it != m_windows.end(); ++it) {
+            if (it.value().lastUse < oldest.value().lastUse)
+                oldest = it;
+        }
+        m_file->unmap(oldest.value().data);
+        m_windows.erase(oldest);
+    }
+}
+
+void StreamSpillFile::addRange(quint64 pos, quint64 end)
+{
+    // Swallow every range touching [pos, end) into one.
+    QMap<quint64, quint64>::iterator it = m_ranges.upperBound(pos);
+    if (it != m_ranges.begin()) {
+        --it;
+        if (it.value() >= pos) {
+            pos = it.key();
+            end = qMax(end, it.value());
+        } else {
+            ++it;
+        }
+    }
+    while (it != m_ranges.end() && it.key() <= end) {
+        end = qMax(end, it.value());
+        it = m_ranges.erase(it);
+    }
+    m_ranges.insert(pos, end);
+}
+
+} // namespace VLC
+} // namespace Phonon
@@ -0,0 +1,110 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_VLC_STREAMSPILLFILE_H
+#define PHONON_VLC_STREAMSPILLFILE_H
+
+#include <QtCore/QMap>
+#include <QtCore/QTemporaryFile>
+
+namespace Phonon {
+namespace VLC {
+
+/** \brief Sparse temporary file holding everything fetched from a stream
+ *
+ * Data is stored at its stream offset, so the file only takes up disk space
+ * for the windows that data was actually written to. The file is accessed
+ * through memory mapped windows of windowSize() bytes; only a limited number
+ * of windows is mapped at any time (least recently used ones get unmapped),
+ * which bounds the memory this takes in our address space while the kernel's
+ * page cache keeps recently used data fast to get at.
+ *
+ * Disk space for a window is allocated before it gets mapped for writing, so
+ * a full disk makes write() fail instead of raising SIGBUS on a store into
+ * the mapping.
+ *
+ * Not thread-safe, StreamReader only uses it from the reading thread.
+ */
+class StreamSpillFile
+{
+public:
+    /**
+     * \param memoryLimit maximum number of bytes mapped at once, either 0 or
+     * at least windowSize()
+     */
+    explicit StreamSpillFile(int memoryLimit);
+    ~StreamSpillFile();
+
+    /// \returns the number of bytes mapped per window, the smallest usable memory limit
+    static int windowSize();
+
+    int memoryLimit() const { return m_memoryLimit; }
+    void setMemoryLimit(int limit);
+
+    /**
+     * Stores \p length bytes of \p data at stream position \p pos. The file
+     * gets created on first use.
+     * \returns \c false if the data could not be stored
+     */
+    bool write(quint64 pos, const char *data, int length);
+
+    /**
+     * Copies up to \p length bytes at stream position \p pos into \p data.
+     * \returns number of bytes copied, 0 if \p pos was never stored
+     */
+    int read(quint64 pos, char *data, int length);
+
+    /**
+     * \returns the end of the contiguously stored data starting at \p pos, or
+     * \p pos itself when it is not stored
+     */
+    quint64 contiguousEnd(quint64 pos) const;
+
+    /// Forgets all data and removes the file.
+    void clear();
+
+private:
+    Q_DISABLE_COPY(StreamSpillFile)
+
+    struct Window {
+        uchar *data;
+        quint64 lastUse;
+    };
+
+    /**
+     * \returns the mapped window containing \p pos, 0 on failure.
+     * \param allocate whether to allocate disk space for the window first
+     */
+    uchar *window(quint64 pos, bool allocate);
+    void unmapWindows(int keep);
+    void addRange(quint64 pos, quint64 end);
+
+    QTemporaryFile *m_file;
+    /// Mapped windows by their index in the file.
+    QMap<quint64, Window> m_windows;
+    /// Stored ranges, start to end.
+    QMap<quint64, quint64> m_ranges;
+    int m_memoryLimit;
+    quint64 m_useCounter;
+    /// Set when the file cannot be used, we stop trying until clear().
+    bool m_failed;
+};
+
+} // namespace VLC
+} // namespace Phonon
+
+#endif // PHONON_VLC_STREAMSPILLFILE_H
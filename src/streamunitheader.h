@@ -0,0 +1,79 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_VLC_STREAMUNITHEADER_H
+#define PHONON_VLC_STREAMUNITHEADER_H
+
+/*
+ * Installed as <phonon-vlc/streamunitheader.h> for stream producers, so it
+ * depends on nothing but the C standard library.
+ *
+ * An AbstractMediaStream opts into elementary stream mode by setting the
+ * dynamic property "vlc-es-category" to "audio", "video" or "subtitle", plus
+ * "vlc-es-codec" (a fourcc like "h264") and whatever else the codec needs,
+ * see StreamReader::loadElementaryStreamFormat(). Every writeData() call is
+ * then exactly one demuxed access unit:
+ *
+ *     PhononVlcStreamUnitHeader header;
+ *     phononVlcInitStreamUnitHeader(&header);
+ *     header.pts = pts;
+ *     QByteArray unit(reinterpret_cast<const char *>(&header), sizeof(header));
+ *     unit.append(payload);
+ *     writeData(unit);
+ *
+ * The header is in host byte order, producer and backend share a process.
+ * Units with an unknown version or a size smaller than this header are
+ * dropped. Later versions only ever append fields and raise size, the
+ * payload always starts size bytes into the unit.
+ */
+
+#include <stdint.h>
+
+#define PHONON_VLC_STREAM_UNIT_VERSION 1
+
+/* Block flags, the same values as VLC's BLOCK_FLAG_*. */
+#define PHONON_VLC_STREAM_UNIT_TYPE_I 0x0002
+#define PHONON_VLC_STREAM_UNIT_TYPE_P 0x0004
+#define PHONON_VLC_STREAM_UNIT_TYPE_B 0x0008
+
+typedef struct PhononVlcStreamUnitHeader {
+    /* PHONON_VLC_STREAM_UNIT_VERSION */
+    uint16_t version;
+    /* Size of this header in bytes, the payload follows it. */
+    uint16_t size;
+    /* PHONON_VLC_STREAM_UNIT_TYPE_* flags, 0 if unknown. */
+    uint32_t flags;
+    /* Presentation timestamp in microseconds, -1 if unknown. */
+    int64_t pts;
+    /* Decoding timestamp in microseconds, -1 if the same as pts. */
+    int64_t dts;
+    /* Must be 0. */
+    uint64_t reserved;
+} PhononVlcStreamUnitHeader;
+
+/* Fills in version and size and marks everything else unknown. */
+static inline void phononVlcInitStreamUnitHeader(PhononVlcStreamUnitHeader *header)
+{
+    header->version = PHONON_VLC_STREAM_UNIT_VERSION;
+    header->size = sizeof(PhononVlcStreamUnitHeader);
+    header->flags = 0;
+    header->pts = -1;
+    header->dts = -1;
+    header->reserved = 0;
+}
+
+#endif /* PHONON_VLC_STREAMUNITHEADER_H */
@@ -0,0 +1,106 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Checks every vector implementation of swapRedBlue24() the CPU can run
+ * byte for byte against the scalar one, for all sizes up to a few thousand
+ * bytes and at every alignment within a vector.
+ *
+ * Usage: phonon_vlc_rgbswizzletest
+ */
+
+// Built in rather than linked, so we can get at every implementation and
+// not only the one picked at runtime.
+#include "video/rgbswizzle.cpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace Phonon::VLC;
+
+#define MAXSIZE 3000
+#define MAXOFFSET 32
+// Bytes behind the end of the data which must stay untouched.
+#define GUARD 64
+
+struct Implementation {
+    const char *name;
+    SwapFunction function;
+};
+
+static int check(const Implementation &implementation)
+{
+    static uchar input[MAXOFFSET + MAXSIZE + GUARD];
+    static uchar expected[MAXOFFSET + MAXSIZE + GUARD];
+    static uchar actual[MAXOFFSET + MAXSIZE + GUARD];
+
+    int failures = 0;
+    for (int size = 0; size < MAXSIZE; ++size) {
+        for (int offset = 0; offset < MAXOFFSET; ++offset) {
+            const int total = offset + size + GUARD;
+            for (int i = 0; i < total; ++i)
+                input[i] = static_cast<uchar>(rand());
+            memcpy(expected, input, total);
+            memcpy(actual, input, total);
+
+            swapRedBlue24Scalar(expected + offset, size);
+            implementation.function(actual + offset, size);
+
+            if (memcmp(expected, actual, total) != 0) {
+                int i = 0;
+                while (expected[i] == actual[i])
+                    ++i;
+                fprintf(stderr, "%s: size %d at offset %d differs at byte %d: %d instead of %d\n",
+                        implementation.name, size, offset, i - offset, actual[i], expected[i]);
+                if (++failures >= 10)
+                    return failures;
+            }
+        }
+    }
+    return failures;
+}
+
+int main()
+{
+    Implementation implementations[4];
+    int count = 0;
+#if defined(SWIZZLE_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        Implementation ssse3 = { "SSSE3", swapRedBlue24Ssse3 };
+        implementations[count++] = ssse3;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        Implementation avx2 = { "AVX2", swapRedBlue24Avx2 };
+        implementations[count++] = avx2;
+    }
+#elif defined(SWIZZLE_NEON)
+    Implementation neon = { "NEON", swapRedBlue24Neon };
+    implementations[count++] = neon;
+#endif
+    Implementation dispatched = { "dispatched", swapRedBlue24 };
+    implementations[count++] = dispatched;
+
+    int failures = 0;
+    for (int i = 0; i < count; ++i) {
+        const int failed = check(implementations[i]);
+        printf("%-10s %s\n", implementations[i].name, failed ? "FAIL" : "ok");
+        failures += failed;
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,336 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Runs SharedFrameWriter, which SharedFrameOutput feeds from libVLC, against
+ * a reader following the protocol of sharedframering.h the way
+ * examples/sharedframeconsumer.cpp does, through a mapping of its own.
+ *
+ * Every frame is filled with a pattern derived from its sequence number, so
+ * the reader can tell whether a frame it accepted was torn. The format
+ * changes every few frames, growing and shrinking, so the reader has to
+ * remap on the way.
+ *
+ *  1. lockstep: the writer waits for the reader after every frame, no frame
+ *     may be missed or torn
+ *  2. free running: the writer does not wait, frames may be missed or found
+ *     torn, but no frame accepted may be torn and sequences must increase.
+ *     Runs with a single slot as well, so the writer overwrites the frame
+ *     being read all the time.
+ *
+ * Usage: phonon_vlc_sharedframetest [frames]
+ */
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QThread>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "video/sharedframering.h"
+#include "video/sharedframewriter.h"
+
+using namespace Phonon::VLC;
+
+#define FRAMESPERFORMAT 50
+
+struct Format {
+    char chroma[5];
+    unsigned width;
+    unsigned height;
+    unsigned planeCount;
+};
+
+// I420 and RV32 as VLC lays them out, small enough to check every byte.
+static const Format s_formats[] = {
+    { "I420", 64, 48, 3 },
+    { "RV32", 320, 240, 1 },
+    { "I420", 32, 16, 3 },
+    { "I420", 640, 360, 3 }
+};
+static const int s_formatCount = sizeof(s_formats) / sizeof(s_formats[0]);
+
+static inline uchar patternAt(quint64 sequence, unsigned plane, size_t i)
+{
+    return static_cast<uchar>(sequence * 31 + plane * 101 + i + (i >> 8));
+}
+
+static void planeLayout(const Format &format, unsigned *pitches, unsigned *lines)
+{
+    for (unsigned i = 0; i < format.planeCount; ++i) {
+        const bool chromaPlane = format.planeCount == 3 && i > 0;
+        const unsigned bytesPerPixel = format.planeCount == 1 ? 4 : 1;
+        pitches[i] = (chromaPlane ? format.width / 2 : format.width) * bytesPerPixel;
+        lines[i] = chromaPlane ? format.height / 2 : format.height;
+    }
+}
+
+/// Reader side, as in examples/sharedframeconsumer.cpp.
+class Reader : public QThread
+{
+public:
+    Reader(const QByteArray &name, bool lockstep)
+        : acknowledged(0)
+        , finished(0)
+        , frames(0)
+        , torn(0)
+        , missed(0)
+        , failures(0)
+        , m_name(name)
+        , m_lockstep(lockstep)
+        , m_fd(-1)
+        , m_data(0)
+        , m_size(0)
+        , m_generation(~0ULL)
+    {
+    }
+
+    /// Sequence of the last frame read, the writer waits for it in lockstep.
+    QAtomicInteger<quint64> acknowledged;
+    /// Set by the writer after its last frame.
+    QAtomicInt finished;
+    quint64 frames;
+    quint64 torn;
+    quint64 missed;
+    int failures;
+
+protected:
+    void run()
+    {
+        m_fd = shm_open(m_name.constData(), O_RDONLY, 0);
+        if (m_fd < 0) {
+            fail("cannot open the object");
+            return;
+        }
+
+        quint64 last = 0;
+        forever {
+            // Only stop after the latest frame was seen.
+            const bool done = finished.loadAcquire();
+            if (!update()) {
+                if (done)
+                    break;
+                QThread::yieldCurrentThread();
+                continue;
+            }
+            const SharedFrameHeader *header = reinterpret_cast<SharedFrameHeader *>(m_data);
+            const quint64 sequence = sharedFrameLoad(&header->latestSequence);
+            if (sequence == 0 || sequence == last) {
+                if (done)
+                    break;
+                QThread::yieldCurrentThread();
+                continue;
+            }
+            if (sequence < last) {
+                fail("sequence went backwards");
+                break;
+            }
+
+            // Being overwritten or reformatted already, try the next one.
+            const SharedFrameSlot *slot = &header->slot[sequence % header->slotCount];
+            if (sharedFrameLoad(&slot->sequence) != sequence) {
+                QThread::yieldCurrentThread();
+                continue;
+            }
+            const SharedFrameSlot layout = *slot;
+            const unsigned planeCount = header->planeCount;
+            if (sharedFrameLoad(&header->generation) != m_generation || !planesMapped(layout, planeCount)) {
+                QThread::yieldCurrentThread();
+                continue;
+            }
+
+            bool intact = true;
+            for (unsigned i = 0; i < planeCount && intact; ++i) {
+                const uchar *plane = m_data + layout.offset[i];
+                const size_t length = static_cast<size_t>(layout.pitch[i]) * layout.lines[i];
+                for (size_t j = 0; j < length; ++j) {
+                    if (plane[j] != patternAt(sequence, i, j)) {
+                        intact = false;
+                        break;
+                    }
+                }
+            }
+
+            sharedFrameReadBarrier();
+            if (sharedFrameLoad(&slot->sequence) != sequence) {
+                ++torn;
+                continue;
+            }
+            if (!intact) {
+                fprintf(stderr, "frame %llu accepted but torn\n", static_cast<unsigned long long>(sequence));
+                ++failures;
+            }
+
+            if (last && sequence > last + 1)
+                missed += sequence - last - 1;
+            last = sequence;
+            ++frames;
+            if (m_lockstep)
+                acknowledged.storeRelease(sequence);
+        }
+
+        if (m_data)
+            munmap(m_data, m_size);
+        close(m_fd);
+    }
+
+private:
+    void fail(const char *message)
+    {
+        fprintf(stderr, "%s\n", message);
+        ++failures;
+        // Do not leave the writer waiting.
+        acknowledged.storeRelease(~0ULL);
+    }
+
+    bool update()
+    {
+        if (m_data) {
+            const SharedFrameHeader *header = reinterpret_cast<SharedFrameHeader *>(m_data);
+            const quint64 generation = sharedFrameLoad(&header->generation);
+            if (generation & 1)
+                return false;
+            if (generation == m_generation && header->size <= m_size)
+                return true;
+        }
+
+        struct stat status;
+        if (fstat(m_fd, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(SharedFrameHeader)))
+            return false;
+        void *data = mmap(0, status.st_size, PROT_READ, MAP_SHARED, m_fd, 0);
+        if (data == MAP_FAILED)
+            return false;
+        if (m_data)
+            munmap(m_data, m_size);
+        m_data = static_cast<uchar *>(data);
+        m_size = status.st_size;
+
+        const SharedFrameHeader *header = reinterpret_cast<SharedFrameHeader *>(m_data);
+        if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SharedFrameMagic)
+            return false;
+        const quint64 generation = sharedFrameLoad(&header->generation);
+        if (generation & 1 || header->size > m_size)
+            return false;
+        m_generation = generation;
+        return true;
+    }
+
+    bool planesMapped(const SharedFrameSlot &slot, unsigned planeCount) const
+    {
+        if (planeCount > SharedFrameMaxPlanes)
+            return false;
+        for (unsigned i = 0; i < planeCount; ++i) {
+            const quint64 length = static_cast<quint64>(slot.pitch[i]) * slot.lines[i];
+            if (slot.offset[i] > m_size || length > m_size - slot.offset[i])
+                return false;
+        }
+        return true;
+    }
+
+    QByteArray m_name;
+    bool m_lockstep;
+    int m_fd;
+    uchar *m_data;
+    quint64 m_size;
+    quint64 m_generation;
+};
+
+static int run(quint64 frameCount, int slotCount, bool lockstep)
+{
+    const QByteArray name = "/phonon-vlc-sharedframetest-" + QByteArray::number(QCoreApplication::applicationPid());
+    SharedFrameWriter writer(name, slotCount);
+    if (!writer.isValid()) {
+        fprintf(stderr, "cannot create %s\n", name.constData());
+        return 1;
+    }
+
+    Reader reader(name, lockstep);
+    reader.start();
+
+    unsigned pitches[SharedFrameMaxPlanes];
+    unsigned lines[SharedFrameMaxPlanes];
+    const Format *format = 0;
+    for (quint64 sequence = 1; sequence <= frameCount; ++sequence) {
+        if ((sequence - 1) % FRAMESPERFORMAT == 0) {
+            format = &s_formats[((sequence - 1) / FRAMESPERFORMAT) % s_formatCount];
+            planeLayout(*format, pitches, lines);
+            if (!writer.setFormat(format->chroma, format->width, format->height,
+                                  format->planeCount, pitches, lines)) {
+                fprintf(stderr, "cannot set format %s\n", format->chroma);
+                reader.finished.storeRelease(1);
+                reader.wait();
+                return 1;
+            }
+        }
+
+        void *planes[SharedFrameMaxPlanes];
+        void *frame = writer.beginFrame(planes);
+        for (unsigned i = 0; i < format->planeCount; ++i) {
+            uchar *plane = static_cast<uchar *>(planes[i]);
+            const size_t length = static_cast<size_t>(pitches[i]) * lines[i];
+            for (size_t j = 0; j < length; ++j)
+                plane[j] = patternAt(sequence, i, j);
+        }
+        writer.publishFrame(frame, sequence * 40000);
+
+        if (lockstep) {
+            while (reader.acknowledged.loadAcquire() < sequence && reader.isRunning())
+                QThread::yieldCurrentThread();
+        }
+    }
+    reader.finished.storeRelease(1);
+    reader.wait();
+
+    int failures = reader.failures;
+    if (lockstep && (reader.frames != frameCount || reader.missed || reader.torn)) {
+        fprintf(stderr, "lockstep must read every frame intact\n");
+        ++failures;
+    }
+    // With a single slot the writer may well never let the reader finish one.
+    if (!lockstep && slotCount > 1 && reader.frames == 0) {
+        fprintf(stderr, "no frame read at all\n");
+        ++failures;
+    }
+    printf("%-12s %d slots %8llu written %8llu read %8llu torn %8llu missed %s\n",
+           lockstep ? "lockstep" : "free running", slotCount,
+           static_cast<unsigned long long>(frameCount),
+           static_cast<unsigned long long>(reader.frames),
+           static_cast<unsigned long long>(reader.torn),
+           static_cast<unsigned long long>(reader.missed),
+           failures ? "FAIL" : "ok");
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    quint64 frames = 2000;
+    if (argc > 1)
+        frames = QByteArray(argv[1]).toULongLong();
+
+    int failures = run(frames, 4, true);
+    failures += run(frames, 4, false);
+    failures += run(frames, 1, false);
+    return failures ? 1 : 0;
+}
@@ -21,6 +21,7 @@
 #include <QtCore/QCoreApplication>
 #include <QtCore/QDebug>
 #include <QtCore/QDir>
+#include <QtCore/QFile>
 #include <QtCore/QSettings>
 #include <QtCore/QString>
 #include <QtCore/QStringBuilder>
@@ -47,6 +48,26 @@ LibVLC::~LibVLC()
     self = 0;
 }
 
+/**
+ * VLC's configuration is not exposed through libVLC, so the video filters
+ * have to be read from the file to keep them when a media sets its own.
+ * Commented out entries are defaults and do not count.
+ */
+static QStringList configuredVideoFilters(const QString &configFileName)
+{
+    QFile file(configFileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return QStringList();
+    while (!file.atEnd()) {
+        const QByteArray line = file.readLine().trimmed();
+        if (line.startsWith("video-filter=")) {
+            const QString value = QString::fromUtf8(line.mid(qstrlen("video-filter=")));
+            return value.split(QLatin1Char(':'), QString::SkipEmptyParts);
+        }
+    }
+    return QStringList();
+}
+
 bool LibVLC::init()
 {
     Q_ASSERT_X(!self, "LibVLC", "there should be only one LibVLC object");
@@ -59,6 +80,7 @@ bool LibVLC::init()
     if (QFile::exists(configFileName)) {
         args << QByteArray("--config=").append(QFile::encodeName(configFileName));
         args << "--no-ignore-config";
+        self->m_videoFilters = configuredVideoFilters(configFileName);
     }
 
     int debugLevel = qgetenv("PHONON_SUBSYSTEM_DEBUG").toInt();
@@ -119,6 +119,15 @@ public:
      */
     static const char *errorMessage();
 
+    /**
+     * \returns the video filters set in the configuration file VLC got
+     * initialized with, empty if none.
+     */
+    QStringList videoFilters() const
+    {
+        return m_videoFilters;
+    }
+
     /**
      * Destruct the LibVLC singleton and release the contained libvlc instance.
      */
@@ -135,6 +144,7 @@ private:
     LibVLC();
 
     libvlc_instance_t *m_vlcInstance;
+    QStringList m_videoFilters;
 };
 
 #endif // LIBVLC_H
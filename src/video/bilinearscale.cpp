@@ -0,0 +1,230 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "bilinearscale.h"
+
+#include <QtCore/QVarLengthArray>
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#  define SCALE_X86
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  define SCALE_NEON
+#  include <arm_neon.h>
+#endif
+
+namespace Phonon {
+namespace VLC {
+
+// Weights are 7 bit fixed point, so that both passes stay within what the
+// 16 bit multiplies of SSE2 can take. Every version rounds the same way and
+// gives exactly the same result.
+#define WEIGHTONE 128
+#define ROUNDING (1 << 13)
+#define SHIFT 14
+
+/**
+ * Maps the centre of destination pixel \p i to the source, as the index of
+ * the left (upper) neighbour and the weight of the right (lower) one. The
+ * index always leaves room for the right neighbour, unless the source is a
+ * single pixel wide, in which case the weight is 0.
+ */
+static inline void sourcePosition(int i, int dstSize, int srcSize, int *index, int *weight)
+{
+    qint64 position = ((2 * qint64(i) + 1) * srcSize * 65536 / dstSize - 65536) / 2;
+    position = qBound<qint64>(0, position, qint64(srcSize - 1) << 16);
+    *index = static_cast<int>(position >> 16);
+    *weight = static_cast<int>(position & 0xffff) >> 9;
+    if (srcSize == 1) {
+        *weight = 0;
+    } else if (*index >= srcSize - 1) {
+        *index = srcSize - 2;
+        *weight = WEIGHTONE;
+    }
+}
+
+typedef void (*RowFunction)(const uchar *top, const uchar *bottom, int wy,
+                            const int *offsets, const int *weights, uchar *dst, int width);
+
+static void scaleRowScalar(const uchar *top, const uchar *bottom, int wy,
+                           const int *offsets, const int *weights, uchar *dst, int width)
+{
+    for (int x = 0; x < width; ++x) {
+        const int wx = weights[x];
+        const uchar *a = top + offsets[x];
+        const uchar *b = wx ? a + 4 : a;
+        const uchar *c = bottom + offsets[x];
+        const uchar *d = wx ? c + 4 : c;
+        for (int i = 0; i < 4; ++i) {
+            const int upper = a[i] * (WEIGHTONE - wx) + b[i] * wx;
+            const int lower = c[i] * (WEIGHTONE - wx) + d[i] * wx;
+            dst[x * 4 + i] = (upper * (WEIGHTONE - wy) + lower * wy + ROUNDING) >> SHIFT;
+        }
+    }
+}
+
+#ifdef SCALE_X86
+/**
+ * Interpolates destination pixels \p x and x + 1 horizontally from \p row.
+ * \returns their channels as 16 bit values, not yet scaled back.
+ */
+__attribute__((target("sse2")))
+static inline __m128i horizontalPairSse2(const uchar *row, const int *offsets, const int *weights, int x)
+{
+    // pmaddwd does a whole interpolation per channel when fed the two
+    // neighbours interleaved and the weight pair (1 - w, w).
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i first = _mm_set1_epi32((weights[x] << 16) | (WEIGHTONE - weights[x]));
+    const __m128i second = _mm_set1_epi32((weights[x + 1] << 16) | (WEIGHTONE - weights[x + 1]));
+
+    // Both neighbours at once, widened to 16 bit.
+    __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(row + offsets[x])), zero);
+    __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(row + offsets[x + 1])), zero);
+    a = _mm_madd_epi16(_mm_unpacklo_epi16(a, _mm_srli_si128(a, 8)), first);
+    b = _mm_madd_epi16(_mm_unpacklo_epi16(b, _mm_srli_si128(b, 8)), second);
+    // At most 255 * WEIGHTONE, so this does not saturate.
+    return _mm_packs_epi32(a, b);
+}
+
+/// \returns destination pixels \p x and x + 1 as 16 bit channels.
+__attribute__((target("sse2")))
+static inline __m128i pairSse2(const uchar *top, const uchar *bottom, __m128i vertical,
+                               const int *offsets, const int *weights, int x)
+{
+    const __m128i rounding = _mm_set1_epi32(ROUNDING);
+    const __m128i upper = horizontalPairSse2(top, offsets, weights, x);
+    const __m128i lower = horizontalPairSse2(bottom, offsets, weights, x);
+    __m128i first = _mm_madd_epi16(_mm_unpacklo_epi16(upper, lower), vertical);
+    __m128i second = _mm_madd_epi16(_mm_unpackhi_epi16(upper, lower), vertical);
+    first = _mm_srai_epi32(_mm_add_epi32(first, rounding), SHIFT);
+    second = _mm_srai_epi32(_mm_add_epi32(second, rounding), SHIFT);
+    return _mm_packs_epi32(first, second);
+}
+
+__attribute__((target("sse2")))
+static void scaleRowSse2(const uchar *top, const uchar *bottom, int wy,
+                         const int *offsets, const int *weights, uchar *dst, int width)
+{
+    const __m128i vertical = _mm_set1_epi32((wy << 16) | (WEIGHTONE - wy));
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        const __m128i first = pairSse2(top, bottom, vertical, offsets, weights, x);
+        const __m128i second = pairSse2(top, bottom, vertical, offsets, weights, x + 2);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x * 4), _mm_packus_epi16(first, second));
+    }
+    scaleRowScalar(top, bottom, wy, offsets + x, weights + x, dst + x * 4, width - x);
+}
+#endif // SCALE_X86
+
+#ifdef SCALE_NEON
+/// \returns destination pixels \p x and x + 1 as 16 bit channels.
+static inline uint16x8_t pairNeon(const uchar *top, const uchar *bottom, int wy,
+                                  const int *offsets, const int *weights, int x)
+{
+    const uint16x8_t leftWeights = vcombine_u16(vdup_n_u16(WEIGHTONE - weights[x]),
+                                                vdup_n_u16(WEIGHTONE - weights[x + 1]));
+    const uint16x8_t rightWeights = vcombine_u16(vdup_n_u16(weights[x]),
+                                                 vdup_n_u16(weights[x + 1]));
+
+    // Both neighbours of both pixels, widened to 16 bit.
+    const uint16x8_t upperFirst = vmovl_u8(vld1_u8(top + offsets[x]));
+    const uint16x8_t upperSecond = vmovl_u8(vld1_u8(top + offsets[x + 1]));
+    const uint16x8_t lowerFirst = vmovl_u8(vld1_u8(bottom + offsets[x]));
+    const uint16x8_t lowerSecond = vmovl_u8(vld1_u8(bottom + offsets[x + 1]));
+
+    // At most 255 * WEIGHTONE, which fits 16 bit.
+    uint16x8_t upper = vmulq_u16(vcombine_u16(vget_low_u16(upperFirst), vget_low_u16(upperSecond)), leftWeights);
+    upper = vmlaq_u16(upper, vcombine_u16(vget_high_u16(upperFirst), vget_high_u16(upperSecond)), rightWeights);
+    uint16x8_t lower = vmulq_u16(vcombine_u16(vget_low_u16(lowerFirst), vget_low_u16(lowerSecond)), leftWeights);
+    lower = vmlaq_u16(lower, vcombine_u16(vget_high_u16(lowerFirst), vget_high_u16(lowerSecond)), rightWeights);
+
+    uint32x4_t first = vmull_n_u16(vget_low_u16(upper), WEIGHTONE - wy);
+    first = vmlal_n_u16(first, vget_low_u16(lower), wy);
+    uint32x4_t second = vmull_n_u16(vget_high_u16(upper), WEIGHTONE - wy);
+    second = vmlal_n_u16(second, vget_high_u16(lower), wy);
+    // Rounds by adding ROUNDING, like the others.
+    return vcombine_u16(vrshrn_n_u32(first, SHIFT), vrshrn_n_u32(second, SHIFT));
+}
+
+static void scaleRowNeon(const uchar *top, const uchar *bottom, int wy,
+                         const int *offsets, const int *weights, uchar *dst, int width)
+{
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        const uint8x8_t first = vqmovn_u16(pairNeon(top, bottom, wy, offsets, weights, x));
+        const uint8x8_t second = vqmovn_u16(pairNeon(top, bottom, wy, offsets, weights, x + 2));
+        vst1q_u8(dst + x * 4, vcombine_u8(first, second));
+    }
+    scaleRowScalar(top, bottom, wy, offsets + x, weights + x, dst + x * 4, width - x);
+}
+#endif // SCALE_NEON
+
+static RowFunction pickRowFunction()
+{
+#if defined(SCALE_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        return scaleRowSse2;
+#elif defined(SCALE_NEON)
+    return scaleRowNeon;
+#endif
+    return scaleRowScalar;
+}
+
+static void scale(RowFunction row,
+                  const uchar *src, int srcWidth, int srcHeight, int srcStride,
+                  uchar *dst, int dstWidth, int dstHeight, int dstStride)
+{
+    if (srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0)
+        return;
+
+    QVarLengthArray<int, 4096> offsets(dstWidth);
+    QVarLengthArray<int, 4096> weights(dstWidth);
+    for (int x = 0; x < dstWidth; ++x) {
+        sourcePosition(x, dstWidth, srcWidth, &offsets[x], &weights[x]);
+        offsets[x] *= 4;
+    }
+
+    for (int y = 0; y < dstHeight; ++y) {
+        int index;
+        int wy;
+        sourcePosition(y, dstHeight, srcHeight, &index, &wy);
+        const uchar *top = src + index * srcStride;
+        const uchar *bottom = wy ? top + srcStride : top;
+        row(top, bottom, wy, offsets.constData(), weights.constData(), dst + y * dstStride, dstWidth);
+    }
+}
+
+void scaleBilinear32Scalar(const uchar *src, int srcWidth, int srcHeight, int srcStride,
+                           uchar *dst, int dstWidth, int dstHeight, int dstStride)
+{
+    scale(scaleRowScalar, src, srcWidth, srcHeight, srcStride, dst, dstWidth, dstHeight, dstStride);
+}
+
+void scaleBilinear32(const uchar *src, int srcWidth, int srcHeight, int srcStride,
+                     uchar *dst, int dstWidth, int dstHeight, int dstStride)
+{
+    static const RowFunction row = pickRowFunction();
+    // The vector versions always load both neighbours.
+    scale(srcWidth > 1 ? row : scaleRowScalar,
+          src, srcWidth, srcHeight, srcStride, dst, dstWidth, dstHeight, dstStride);
+}
+
+} // namespace VLC
+} // namespace Phonon
@@ -0,0 +1,44 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_VLC_BILINEARSCALE_H
+#define PHONON_VLC_BILINEARSCALE_H
+
+#include <QtCore/QtGlobal>
+
+namespace Phonon {
+namespace VLC {
+
+/**
+ * Scales a 32 bit per pixel image (RV32, ARGB32 and the like, the channels
+ * are treated alike) from \p src to \p dst with bilinear filtering. Strides
+ * are in bytes.
+ *
+ * Uses SSE2 or NEON when the CPU has it, picked once at runtime; those
+ * interpolate four pixels at a time.
+ */
+void scaleBilinear32(const uchar *src, int srcWidth, int srcHeight, int srcStride,
+                     uchar *dst, int dstWidth, int dstHeight, int dstStride);
+
+/// Plain C version of scaleBilinear32(), the reference for the others.
+void scaleBilinear32Scalar(const uchar *src, int srcWidth, int srcHeight, int srcStride,
+                           uchar *dst, int dstWidth, int dstHeight, int dstStride);
+
+} // namespace VLC
+} // namespace Phonon
+
+#endif // PHONON_VLC_BILINEARSCALE_H
@@ -0,0 +1,203 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "planeallocator.h"
+
+#include <QtCore/QGlobalStatic>
+
+#include <stdlib.h>
+#ifdef Q_OS_LINUX
+#include <sys/mman.h>
+#endif
+
+namespace Phonon {
+namespace VLC {
+
+// Minimum alignment of every plane, a cache line and enough for AVX-512.
+#define PLANEALIGNMENT 64
+// From this size on planes are page aligned.
+#define PAGEALIGNMENTSIZE (64 * 1024)
+#define PAGESIZE 4096
+// From this size on planes are huge page aligned.
+#define HUGEALIGNMENTSIZE (4 * 1024 * 1024)
+#define HUGEPAGESIZE (2 * 1024 * 1024)
+// Unused buffers are freed beyond this many per size class, one picture set
+// of VideoMemoryStream and a spare.
+#define POOLCLASSLIMIT 4
+// ...and beyond this many bytes overall, a set of 4K RGB frames.
+#define POOLLIMIT (128 * 1024 * 1024)
+
+Q_GLOBAL_STATIC(PlaneAllocator, s_planeAllocator)
+
+static int alignmentFor(int classSize)
+{
+    if (classSize >= HUGEALIGNMENTSIZE)
+        return HUGEPAGESIZE;
+    if (classSize >= PAGEALIGNMENTSIZE)
+        return PAGESIZE;
+    return PLANEALIGNMENT;
+}
+
+/**
+ * Rounds \p size up to its size class. There are four classes per power of
+ * two, so at most a quarter of a buffer goes unused.
+ */
+static int sizeClass(int size)
+{
+    if (size <= PAGESIZE)
+        return (size + PLANEALIGNMENT - 1) / PLANEALIGNMENT * PLANEALIGNMENT;
+    int power = PAGESIZE;
+    while (power <= size / 2)
+        power *= 2;
+    const int step = power / 4;
+    return (size + step - 1) / step * step;
+}
+
+static char *allocateAligned(int classSize)
+{
+    const int alignment = alignmentFor(classSize);
+    void *data = 0;
+#ifdef Q_OS_UNIX
+    if (posix_memalign(&data, alignment, classSize) != 0)
+        return 0;
+#else
+    data = qMallocAligned(classSize, alignment);
+#endif
+#if defined(Q_OS_LINUX) && defined(MADV_HUGEPAGE)
+    if (alignment == HUGEPAGESIZE)
+        madvise(data, classSize, MADV_HUGEPAGE);
+#endif
+    return static_cast<char *>(data);
+}
+
+static void freeAligned(char *data)
+{
+#ifdef Q_OS_UNIX
+    free(data);
+#else
+    qFreeAligned(data);
+#endif
+}
+
+PlaneAllocator *PlaneAllocator::instance()
+{
+    return s_planeAllocator();
+}
+
+PlaneAllocator::PlaneAllocator()
+    : m_pooledBytes(0)
+    , m_users(0)
+{
+}
+
+PlaneAllocator::~PlaneAllocator()
+{
+    // Orphans may still be referenced by someone and are left alone.
+    freePool();
+}
+
+void PlaneAllocator::addUser()
+{
+    QMutexLocker lock(&m_mutex);
+    ++m_users;
+}
+
+void PlaneAllocator::removeUser()
+{
+    QMutexLocker lock(&m_mutex);
+    Q_ASSERT(m_users > 0);
+    if (--m_users == 0)
+        freePool();
+}
+
+QByteArray PlaneAllocator::allocate(int size)
+{
+    const int classSize = sizeClass(qMax(1, size));
+    char *data = 0;
+    {
+        QMutexLocker lock(&m_mutex);
+        reclaimOrphans();
+        QList<char *> &pool = m_free[classSize];
+        if (!pool.isEmpty()) {
+            data = pool.takeLast();
+            m_pooledBytes -= classSize;
+        }
+    }
+    if (!data)
+        data = allocateAligned(classSize);
+    if (!data)
+        qFatal("Cannot allocate a video plane of %d bytes", classSize);
+    return QByteArray::fromRawData(data, size);
+}
+
+void PlaneAllocator::release(QByteArray &plane)
+{
+    if (plane.isNull())
+        return;
+
+    QMutexLocker lock(&m_mutex);
+    if (plane.isDetached())
+        recycle(const_cast<char *>(plane.constData()), sizeClass(qMax(1, plane.size())));
+    else
+        m_orphans.append(plane);
+    plane = QByteArray();
+    reclaimOrphans();
+}
+
+qint64 PlaneAllocator::pooledBytes() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_pooledBytes;
+}
+
+void PlaneAllocator::reclaimOrphans()
+{
+    QList<QByteArray>::iterator it = m_orphans.begin();
+    while (it != m_orphans.end()) {
+        if (it->isDetached()) {
+            recycle(const_cast<char *>(it->constData()), sizeClass(qMax(1, it->size())));
+            it = m_orphans.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void PlaneAllocator::recycle(char *data, int classSize)
+{
+    QList<char *> &pool = m_free[classSize];
+    if (!m_users || pool.size() >= POOLCLASSLIMIT || m_pooledBytes + classSize > POOLLIMIT) {
+        freeAligned(data);
+        return;
+    }
+    pool.append(data);
+    m_pooledBytes += classSize;
+}
+
+void PlaneAllocator::freePool()
+{
+    QHash<int, QList<char *> >::const_iterator it = m_free.constBegin();
+    for (; it != m_free.constEnd(); ++it) {
+        foreach (char *data, it.value())
+            freeAligned(data);
+    }
+    m_free.clear();
+    m_pooledBytes = 0;
+}
+
+} // namespace VLC
+} // namespace Phonon
@@ -0,0 +1,94 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_VLC_PLANEALLOCATOR_H
+#define PHONON_VLC_PLANEALLOCATOR_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+
+namespace Phonon {
+namespace VLC {
+
+/** \brief Process wide pool of aligned video plane buffers
+ *
+ * Planes are at least 64 byte aligned, large ones page aligned and huge ones
+ * aligned for (and, on Linux, advised to use) huge pages. Buffers are kept
+ * in size classes, so a format change or the next media object gets the
+ * buffers of the previous one back instead of going through malloc again.
+ * Only a few buffers per size class are kept, and none once the last user
+ * is gone.
+ *
+ * Planes are handed out as QByteArray::fromRawData(), so they can be shared
+ * with frontends as usual. Two things follow from that:
+ * \li write through const_cast<char *>(plane.constData()), data() would copy
+ * \li a released plane only gets reused once every copy of it is gone
+ *
+ * Thread-safe.
+ */
+class PlaneAllocator
+{
+public:
+    static PlaneAllocator *instance();
+
+    PlaneAllocator();
+    ~PlaneAllocator();
+
+    /// \returns a plane of \p size bytes with undefined contents
+    QByteArray allocate(int size);
+
+    /**
+     * Gives \p plane, which must come from allocate(), back to the pool and
+     * clears it. Copies of it stay valid.
+     */
+    void release(QByteArray &plane);
+
+    /// \returns number of bytes kept in the pool for reuse
+    qint64 pooledBytes() const;
+
+    /**
+     * Registers something that allocates planes now and then. Buffers are
+     * only pooled while there is one, removing the last frees the pool.
+     */
+    void addUser();
+    void removeUser();
+
+private:
+    Q_DISABLE_COPY(PlaneAllocator)
+
+    /// Takes back orphans nobody references anymore, m_mutex must be locked.
+    void reclaimOrphans();
+    /// Pools or frees \p data of size class \p classSize, m_mutex must be locked.
+    void recycle(char *data, int classSize);
+    /// Frees all pooled buffers, m_mutex must be locked.
+    void freePool();
+
+    mutable QMutex m_mutex;
+    /// Unused buffers by size class.
+    QHash<int, QList<char *> > m_free;
+    qint64 m_pooledBytes;
+    int m_users;
+    /// Released planes which still have copies around.
+    QList<QByteArray> m_orphans;
+};
+
+} // namespace VLC
+} // namespace Phonon
+
+#endif // PHONON_VLC_PLANEALLOCATOR_H
@@ -0,0 +1,119 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rgbswizzle.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#  define SWIZZLE_X86
+#  include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  define SWIZZLE_NEON
+#  include <arm_neon.h>
+#endif
+
+namespace Phonon {
+namespace VLC {
+
+void swapRedBlue24Scalar(uchar *data, int size)
+{
+    uchar *end = data + size - size % 3;
+    for (; data < end; data += 3) {
+        const uchar tmp = data[0];
+        data[0] = data[2];
+        data[2] = tmp;
+    }
+}
+
+#ifdef SWIZZLE_X86
+// A 16 byte vector holds five whole pixels plus the first byte of the next
+// one. We swap the five pixels, leave the 16th byte alone and advance by 15,
+// so that byte gets loaded again as part of the next pixel.
+#define SWIZZLE_MASK 2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15
+
+__attribute__((target("ssse3")))
+static void swapRedBlue24Ssse3(uchar *data, int size)
+{
+    const __m128i mask = _mm_setr_epi8(SWIZZLE_MASK);
+    int i = 0;
+    for (; i + 16 <= size; i += 15) {
+        __m128i *p = reinterpret_cast<__m128i *>(data + i);
+        _mm_storeu_si128(p, _mm_shuffle_epi8(_mm_loadu_si128(p), mask));
+    }
+    swapRedBlue24Scalar(data + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static void swapRedBlue24Avx2(uchar *data, int size)
+{
+    // vpshufb works on the two 128 bit lanes separately, so feed each lane
+    // the same 15 byte step as above. The second store overwrites the 16th
+    // byte of the first one with its swapped value.
+    const __m256i mask = _mm256_setr_epi8(SWIZZLE_MASK, SWIZZLE_MASK);
+    int i = 0;
+    for (; i + 31 <= size; i += 30) {
+        __m128i *low = reinterpret_cast<__m128i *>(data + i);
+        __m128i *high = reinterpret_cast<__m128i *>(data + i + 15);
+        __m256i pixels = _mm256_castsi128_si256(_mm_loadu_si128(low));
+        pixels = _mm256_inserti128_si256(pixels, _mm_loadu_si128(high), 1);
+        pixels = _mm256_shuffle_epi8(pixels, mask);
+        _mm_storeu_si128(low, _mm256_castsi256_si128(pixels));
+        _mm_storeu_si128(high, _mm256_extracti128_si256(pixels, 1));
+    }
+    swapRedBlue24Ssse3(data + i, size - i);
+}
+#endif // SWIZZLE_X86
+
+#ifdef SWIZZLE_NEON
+static void swapRedBlue24Neon(uchar *data, int size)
+{
+    // The structure loads split the pixels into channels for us.
+    int i = 0;
+    for (; i + 48 <= size; i += 48) {
+        uint8x16x3_t pixels = vld3q_u8(data + i);
+        const uint8x16_t tmp = pixels.val[0];
+        pixels.val[0] = pixels.val[2];
+        pixels.val[2] = tmp;
+        vst3q_u8(data + i, pixels);
+    }
+    swapRedBlue24Scalar(data + i, size - i);
+}
+#endif // SWIZZLE_NEON
+
+typedef void (*SwapFunction)(uchar *data, int size);
+
+static SwapFunction pickSwapFunction()
+{
+#if defined(SWIZZLE_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return swapRedBlue24Avx2;
+    if (__builtin_cpu_supports("ssse3"))
+        return swapRedBlue24Ssse3;
+#elif defined(SWIZZLE_NEON)
+    return swapRedBlue24Neon;
+#endif
+    return swapRedBlue24Scalar;
+}
+
+void swapRedBlue24(uchar *data, int size)
+{
+    static const SwapFunction swap = pickSwapFunction();
+    swap(data, size);
+}
+
+} // namespace VLC
+} // namespace Phonon
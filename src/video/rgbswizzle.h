@@ -0,0 +1,41 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_VLC_RGBSWIZZLE_H
+#define PHONON_VLC_RGBSWIZZLE_H
+
+#include <QtCore/QtGlobal>
+
+namespace Phonon {
+namespace VLC {
+
+/**
+ * Swaps the first and third byte of every 3 byte pixel in \p data, in place,
+ * i.e. turns BGR24 into RGB24 and vice versa. \p size should be a multiple of
+ * 3, a trailing partial pixel is left alone.
+ *
+ * Uses SSSE3, AVX2 or NEON when the CPU has it, picked once at runtime.
+ */
+void swapRedBlue24(uchar *data, int size);
+
+/// Plain C version of swapRedBlue24(), the reference for the others.
+void swapRedBlue24Scalar(uchar *data, int size);
+
+} // namespace VLC
+} // namespace Phonon
+
+#endif // PHONON_VLC_RGBSWIZZLE_H
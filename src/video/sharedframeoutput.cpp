@@ -0,0 +1,108 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sharedframeoutput.h"
+
+#include "utils/debug.h"
+#include "media.h"
+#include "mediaplayer.h"
+#include "sharedframering.h"
+
+namespace Phonon {
+namespace VLC {
+
+SharedFrameOutput::SharedFrameOutput(const QByteArray &name, int slotCount)
+    : m_writer(name, slotCount)
+{
+}
+
+SharedFrameOutput::~SharedFrameOutput()
+{
+    // The base class cannot call our handler anymore.
+    if (m_mediaObject)
+        disconnectFromMediaObject(m_mediaObject);
+}
+
+void SharedFrameOutput::handleConnectToMediaObject(MediaObject *mediaObject)
+{
+    Q_UNUSED(mediaObject);
+    if (isValid())
+        setCallbacks(m_player);
+}
+
+void SharedFrameOutput::handleDisconnectFromMediaObject(MediaObject *mediaObject)
+{
+    Q_UNUSED(mediaObject);
+    if (isValid())
+        unsetCallbacks(m_player);
+}
+
+void SharedFrameOutput::handleAddToMedia(Media *media)
+{
+    media->addOption(":video");
+}
+
+void *SharedFrameOutput::lockCallback(void **planes)
+{
+    // vmem only ever has one picture in flight, so frames get published in
+    // the order they are begun.
+    return m_writer.beginFrame(planes);
+}
+
+void SharedFrameOutput::unlockCallback(void *picture, void *const *planes)
+{
+    Q_UNUSED(picture);
+    Q_UNUSED(planes);
+}
+
+void SharedFrameOutput::displayCallback(void *picture)
+{
+    // See VideoMemoryStream::displayPicture(), never ask libVLC from here.
+    m_writer.publishFrame(picture, m_player->estimatedTime());
+}
+
+unsigned SharedFrameOutput::formatCallback(char *chroma,
+                                           unsigned *width, unsigned *height,
+                                           unsigned *pitches, unsigned *lines)
+{
+    DEBUG_BLOCK;
+    if (!isValid())
+        return 0;
+
+    const vlc_chroma_description_t *chromaDesc =
+            vlc_fourcc_GetChromaDescription(VLC_FOURCC(chroma[0], chroma[1], chroma[2], chroma[3]));
+    if (!chromaDesc || chromaDesc->plane_count > SharedFrameMaxPlanes) {
+        // Opaque hardware surfaces and the like, consumers cannot map those.
+        debug() << "Converting unsupported chroma" << QByteArray(chroma, 4) << "to RV32";
+        qstrcpy(chroma, "RV32");
+        chromaDesc = vlc_fourcc_GetChromaDescription(VLC_CODEC_RGB32);
+    }
+    Q_ASSERT(chromaDesc);
+
+    const unsigned bufferSize = setPitchAndLines(chromaDesc, *width, *height, pitches, lines);
+    if (!m_writer.setFormat(chroma, *width, *height, chromaDesc->plane_count, pitches, lines))
+        return 0;
+    return bufferSize;
+}
+
+void SharedFrameOutput::formatCleanUpCallback()
+{
+    DEBUG_BLOCK;
+}
+
+} // namespace VLC
+} // namespace Phonon
@@ -0,0 +1,76 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_VLC_SHAREDFRAMEOUTPUT_H
+#define PHONON_VLC_SHAREDFRAMEOUTPUT_H
+
+#include <QtCore/QByteArray>
+
+#include "sharedframewriter.h"
+#include "sinknode.h"
+#include "videomemorystream.h"
+
+namespace Phonon {
+namespace VLC {
+
+/** \brief Video output decoding straight into POSIX shared memory
+ *
+ * VLC decodes every frame into a ring of slots inside a shared memory object,
+ * other processes on the machine map that object and read the frames in
+ * place, no copy is made anywhere. See sharedframering.h for the layout and
+ * the protocol readers have to follow.
+ *
+ * The frames keep the chroma the decoder produces, consumers get its fourcc
+ * and have to cope with it.
+ *
+ * Like any other VideoMemoryStream this replaces the video output of the
+ * player it is connected to, so nothing is shown on screen meanwhile.
+ */
+class SharedFrameOutput : public SinkNode, private VideoMemoryStream
+{
+public:
+    /// See SharedFrameWriter for the arguments.
+    explicit SharedFrameOutput(const QByteArray &name, int slotCount = 4);
+    ~SharedFrameOutput();
+
+    QByteArray name() const { return m_writer.name(); }
+
+    /// \returns whether the shared memory object could be created
+    bool isValid() const { return m_writer.isValid(); }
+
+    void handleConnectToMediaObject(MediaObject *mediaObject);
+    void handleDisconnectFromMediaObject(MediaObject *mediaObject);
+    void handleAddToMedia(Media *media);
+
+private:
+    virtual void *lockCallback(void **planes);
+    virtual void unlockCallback(void *picture, void *const *planes);
+    virtual void displayCallback(void *picture);
+
+    virtual unsigned formatCallback(char *chroma,
+                                    unsigned *width, unsigned *height,
+                                    unsigned *pitches,
+                                    unsigned *lines);
+    virtual void formatCleanUpCallback();
+
+    SharedFrameWriter m_writer;
+};
+
+} // namespace VLC
+} // namespace Phonon
+
+#endif // PHONON_VLC_SHAREDFRAMEOUTPUT_H
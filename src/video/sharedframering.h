@@ -0,0 +1,108 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_VLC_SHAREDFRAMERING_H
+#define PHONON_VLC_SHAREDFRAMERING_H
+
+/*
+ * Layout of the shared memory object SharedFrameOutput decodes into. This
+ * header is meant to be copied into consumers, so it must not depend on Qt,
+ * VLC or anything else from the backend.
+ *
+ * The object starts with a SharedFrameHeader, followed by slotCount slots of
+ * plane data. Frames get increasing sequence numbers starting at 1, frame n
+ * always lives in slot n % slotCount. Reading the latest frame goes:
+ *
+ *   1. seq = load(header->latestSequence), 0 means nothing was shown yet
+ *   2. slot = header->slot[seq % header->slotCount]
+ *   3. skip the frame if load(slot->sequence) != seq, it is being overwritten
+ *   4. use the planes at mapping + slot->offset[i]
+ *   5. drop whatever was derived from them if load(slot->sequence) != seq now
+ *
+ * The writer never waits for readers, slow readers just fail step 3 or 5.
+ * When the video format changes, generation becomes odd while the layout is
+ * rewritten and size may grow (it never shrinks), so readers compare
+ * generation and size with what they mapped before every frame.
+ */
+
+#include <stdint.h>
+
+namespace Phonon {
+namespace VLC {
+
+enum {
+    SharedFrameMagic = 0x52465650, // "PVFR" in memory on little endian
+    SharedFrameVersion = 1,
+    SharedFrameMaxSlots = 8,
+    SharedFrameMaxPlanes = 4
+};
+
+struct SharedFrameSlot {
+    /// Sequence number of the frame in here, 0 while it gets decoded into.
+    uint64_t sequence;
+    /// Playback time of the frame in microseconds, -1 if unknown.
+    int64_t pts;
+    /// Offset of every plane from the start of the object.
+    uint64_t offset[SharedFrameMaxPlanes];
+    uint32_t pitch[SharedFrameMaxPlanes];
+    uint32_t lines[SharedFrameMaxPlanes];
+};
+
+struct SharedFrameHeader {
+    uint32_t magic;
+    uint32_t version;
+    /// Odd while the writer changes the format.
+    uint64_t generation;
+    /// Number of bytes the object currently spans.
+    uint64_t size;
+    /// VLC fourcc of the planes, e.g. "I420" or "RV32".
+    char chroma[4];
+    uint32_t width;
+    uint32_t height;
+    uint32_t planeCount;
+    uint32_t slotCount;
+    uint32_t reserved;
+    uint64_t latestSequence;
+    SharedFrameSlot slot[SharedFrameMaxSlots];
+};
+
+inline uint64_t sharedFrameLoad(const uint64_t *value)
+{
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+inline void sharedFrameStore(uint64_t *value, uint64_t newValue)
+{
+    __atomic_store_n(value, newValue, __ATOMIC_RELEASE);
+}
+
+/// Orders plain reads of plane data before a following sharedFrameLoad().
+inline void sharedFrameReadBarrier()
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+/// Orders a preceding sharedFrameStore() before plain writes of plane data.
+inline void sharedFrameWriteBarrier()
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+} // namespace VLC
+} // namespace Phonon
+
+#endif // PHONON_VLC_SHAREDFRAMERING_H
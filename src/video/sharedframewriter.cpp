@@ -0,0 +1,186 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "sharedframewriter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils/debug.h"
+#include "sharedframering.h"
+
+namespace Phonon {
+namespace VLC {
+
+// Planes start on cache line boundaries, which also suits SIMD loads.
+#define PLANEALIGNMENT 64
+
+static inline quint64 alignedTo(quint64 value, quint64 alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static inline quint64 headerSize()
+{
+    return alignedTo(sizeof(SharedFrameHeader), sysconf(_SC_PAGESIZE));
+}
+
+SharedFrameWriter::SharedFrameWriter(const QByteArray &name, int slotCount)
+    : m_name(name)
+    , m_slotCount(qBound(1, slotCount, static_cast<int>(SharedFrameMaxSlots)))
+    , m_fd(-1)
+    , m_data(0)
+    , m_mappedSize(0)
+    , m_header(0)
+    , m_sequence(0)
+{
+    // Never take over an existing object, someone else may be using it.
+    m_fd = shm_open(m_name.constData(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (m_fd < 0) {
+        if (errno == EEXIST) {
+            warning() << "Shared memory object" << m_name << "exists already,"
+                      << "not publishing frames. Remove it if it was left behind by a crash.";
+        } else {
+            warning() << "Cannot create shared memory object" << m_name << strerror(errno);
+        }
+        return;
+    }
+    if (!reserve(headerSize()))
+        return;
+
+    m_header->version = SharedFrameVersion;
+    m_header->slotCount = m_slotCount;
+    m_header->size = m_mappedSize;
+    sharedFrameWriteBarrier();
+    m_header->magic = SharedFrameMagic;
+    debug() << "Publishing frames in" << m_name;
+}
+
+SharedFrameWriter::~SharedFrameWriter()
+{
+    unmap();
+    // Only ever unlink what we created.
+    if (m_fd >= 0) {
+        close(m_fd);
+        shm_unlink(m_name.constData());
+    }
+}
+
+bool SharedFrameWriter::setFormat(const char *chroma, unsigned width, unsigned height,
+                                  unsigned planeCount, const unsigned *pitches, const unsigned *lines)
+{
+    if (!m_header || planeCount > SharedFrameMaxPlanes)
+        return false;
+
+    quint64 planeOffsets[SharedFrameMaxPlanes];
+    quint64 slotSize = 0;
+    for (unsigned i = 0; i < planeCount; ++i) {
+        planeOffsets[i] = slotSize;
+        slotSize += alignedTo(static_cast<quint64>(pitches[i]) * lines[i], PLANEALIGNMENT);
+    }
+    const quint64 dataOffset = headerSize();
+
+    // Readers must not trust anything in the header until this is even again.
+    sharedFrameStore(&m_header->generation, m_header->generation + 1);
+    sharedFrameWriteBarrier();
+    sharedFrameStore(&m_header->latestSequence, 0);
+
+    if (!reserve(dataOffset + slotSize * m_slotCount)) {
+        sharedFrameStore(&m_header->generation, m_header->generation + 1);
+        return false;
+    }
+
+    memcpy(m_header->chroma, chroma, sizeof(m_header->chroma));
+    m_header->width = width;
+    m_header->height = height;
+    m_header->planeCount = planeCount;
+    m_header->size = m_mappedSize;
+    for (int i = 0; i < m_slotCount; ++i) {
+        SharedFrameSlot &slot = m_header->slot[i];
+        sharedFrameStore(&slot.sequence, 0);
+        slot.pts = -1;
+        for (unsigned j = 0; j < planeCount; ++j) {
+            slot.offset[j] = dataOffset + i * slotSize + planeOffsets[j];
+            slot.pitch[j] = pitches[j];
+            slot.lines[j] = lines[j];
+        }
+    }
+    sharedFrameStore(&m_header->generation, m_header->generation + 1);
+
+    debug() << "Sharing" << QByteArray(chroma, 4) << width << "x" << height
+            << "frames in" << m_slotCount << "slots," << m_mappedSize << "bytes";
+    return true;
+}
+
+void *SharedFrameWriter::beginFrame(void **planes)
+{
+    const quint64 sequence = ++m_sequence;
+    SharedFrameSlot *slot = &m_header->slot[sequence % m_header->slotCount];
+    sharedFrameStore(&slot->sequence, 0);
+    sharedFrameWriteBarrier();
+
+    for (unsigned i = 0; i < m_header->planeCount; ++i)
+        planes[i] = m_data + slot->offset[i];
+    return slot;
+}
+
+void SharedFrameWriter::publishFrame(void *frame, qint64 pts)
+{
+    SharedFrameSlot *slot = static_cast<SharedFrameSlot *>(frame);
+    // Frames are published in the order they were begun, one at a time.
+    slot->pts = pts;
+    sharedFrameStore(&slot->sequence, m_sequence);
+    sharedFrameStore(&m_header->latestSequence, m_sequence);
+}
+
+bool SharedFrameWriter::reserve(quint64 size)
+{
+    if (size <= m_mappedSize)
+        return true;
+
+    // Never shrinks, readers may still have the old size mapped.
+    if (ftruncate(m_fd, size) != 0) {
+        warning() << "Cannot grow shared memory object" << m_name << strerror(errno);
+        return false;
+    }
+    void *data = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED) {
+        warning() << "Cannot map shared memory object" << m_name << strerror(errno);
+        return false;
+    }
+    unmap();
+    m_data = static_cast<uchar *>(data);
+    m_mappedSize = size;
+    m_header = reinterpret_cast<SharedFrameHeader *>(m_data);
+    return true;
+}
+
+void SharedFrameWriter::unmap()
+{
+    if (m_data)
+        munmap(m_data, m_mappedSize);
+    m_data = 0;
+    m_mappedSize = 0;
+    m_header = 0;
+}
+
+} // namespace VLC
+} // namespace Phonon
@@ -0,0 +1,96 @@
+/*
+    Copyright (C) 2014 vlc-phonon AUTHORS <kde-multimedia@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHONON_VLC_SHAREDFRAMEWRITER_H
+#define PHONON_VLC_SHAREDFRAMEWRITER_H
+
+#include <QtCore/QByteArray>
+
+namespace Phonon {
+namespace VLC {
+
+struct SharedFrameHeader;
+struct SharedFrameSlot;
+
+/** \brief Writer side of the shared frame ring, see sharedframering.h
+ *
+ * Owns the POSIX shared memory object and keeps its header and slots up to
+ * date. Knows nothing about VLC, SharedFrameOutput feeds it from the vmem
+ * callbacks.
+ *
+ * Only one thread may use a writer at a time.
+ */
+class SharedFrameWriter
+{
+public:
+    /**
+     * \param name name of the shared memory object to create, as understood
+     * by shm_open(), e.g. "/phonon-vlc". Fails if such an object exists.
+     * \param slotCount number of frames kept, readers have about as many frame
+     * durations to finish a frame before it gets overwritten
+     */
+    explicit SharedFrameWriter(const QByteArray &name, int slotCount = 4);
+    ~SharedFrameWriter();
+
+    QByteArray name() const { return m_name; }
+
+    /// \returns whether the shared memory object could be created
+    bool isValid() const { return m_header; }
+
+    /**
+     * Lays out the slots for frames of the given format, growing the object
+     * as needed. Readers drop what they had and start over.
+     *
+     * \returns false if the object cannot hold the frames
+     */
+    bool setFormat(const char *chroma, unsigned width, unsigned height,
+                   unsigned planeCount, const unsigned *pitches, const unsigned *lines);
+
+    /**
+     * Takes the slot of the next frame from readers and fills in \p planes.
+     * \returns the frame to pass to publishFrame()
+     */
+    void *beginFrame(void **planes);
+
+    /**
+     * Makes the frame from beginFrame() the latest one.
+     * \param pts playback time of the frame in microseconds, -1 if unknown
+     */
+    void publishFrame(void *frame, qint64 pts);
+
+private:
+    Q_DISABLE_COPY(SharedFrameWriter)
+
+    /// Grows the object to at least \p size bytes and maps all of it.
+    bool reserve(quint64 size);
+    void unmap();
+
+    QByteArray m_name;
+    int m_slotCount;
+    int m_fd;
+    uchar *m_data;
+    quint64 m_mappedSize;
+    SharedFrameHeader *m_header;
+
+    /// Sequence number of the frame written right now.
+    quint64 m_sequence;
+};
+
+} // namespace VLC
+} // namespace Phonon
+
+#endif // PHONON_VLC_SHAREDFRAMEWRITER_H
@@ -26,10 +26,12 @@
 #include <phonon/experimental/abstractvideodataoutput.h>
 
 #include <QMetaObject>
+#include <QThread>
 
 #include "utils/debug.h"
 #include "media.h"
 #include "mediaobject.h"
+#include "rgbswizzle.h"
 
 using namespace Phonon::Experimental;
 
@@ -38,14 +40,58 @@ namespace Phonon
 namespace VLC
 {
 
+// Default number of frames waiting for the frontend.
+#define QUEUESIZE 4
+// Up to this delivery rate frames nothing depends on are not even decoded.
+#define SKIPNONREFRATE 5
+
+class FrameDeliveryThread : public QThread
+{
+public:
+    explicit FrameDeliveryThread(VideoDataOutput *output)
+        : m_output(output)
+    {
+    }
+
+protected:
+    void run()
+    {
+        m_output->deliverFrames();
+    }
+
+private:
+    VideoDataOutput *m_output;
+};
+
 VideoDataOutput::VideoDataOutput(QObject *parent)
     : QObject(parent)
     , m_frontend(0)
+    , m_queueSize(QUEUESIZE)
+    , m_overflowPolicy(DropOldest)
+    , m_droppedFrames(0)
+    , m_swapChroma(false)
+    , m_frameInterval(1)
+    , m_maximumFrameRate(0)
+    , m_filterRate(0)
+    , m_stopDelivery(false)
+    , m_deliveryThread(new FrameDeliveryThread(this))
+    , m_framePts(-1)
+    , m_frameSequence(0)
+    , m_skipPicture(false)
+    , m_framesSinceDelivery(0)
 {
+    m_deliveryThread->start();
 }
 
 VideoDataOutput::~VideoDataOutput()
 {
+    m_queueMutex.lock();
+    m_stopDelivery = true;
+    m_queueNotEmpty.wakeAll();
+    m_queueNotFull.wakeAll();
+    m_queueMutex.unlock();
+    m_deliveryThread->wait();
+    delete m_deliveryThread;
 }
 
 void VideoDataOutput::handleConnectToMediaObject(MediaObject *mediaObject)
@@ -58,11 +104,26 @@ void VideoDataOutput::handleDisconnectFromMediaObject(MediaObject *mediaObject)
 {
     Q_UNUSED(mediaObject);
     unsetCallbacks(m_player);
+    clearQueue();
 }
 
 void VideoDataOutput::handleAddToMedia(Media *media)
 {
     media->addOption(":video");
+
+    QMutexLocker lock(&m_queueMutex);
+    const qreal rate = m_maximumFrameRate;
+    m_filterRate = 0;
+    if (rate <= 0)
+        return;
+#if (LIBVLC_VERSION_INT >= LIBVLC_VERSION(3, 0, 0, 0))
+    // Frames the filter drops are never converted nor handed to us.
+    media->addVideoFilter(QLatin1String("fps"));
+    media->addOption(":fps-fps=", rate);
+    m_filterRate = rate;
+#endif
+    if (rate <= SKIPNONREFRATE)
+        media->addOption(":avcodec-skip-frame=1");
 }
 
 Experimental::AbstractVideoDataOutput *VideoDataOutput::frontendObject() const
@@ -72,121 +133,357 @@ Experimental::AbstractVideoDataOutput *VideoDataOutput::frontendObject() const
 
 void VideoDataOutput::setFrontendObject(Experimental::AbstractVideoDataOutput *frontend)
 {
+    QMutexLocker lock(&m_mutex);
     m_frontend = frontend;
 }
 
-void *VideoDataOutput::lockCallback(void **planes)
+int VideoDataOutput::queueSize() const
 {
-    m_mutex.lock();
-    DEBUG_BLOCK;
-    planes[0] = reinterpret_cast<void *>(m_frame.data0.data());
-    planes[1] = reinterpret_cast<void *>(m_frame.data1.data());
-    planes[2] = reinterpret_cast<void *>(m_frame.data2.data());
-    return 0;
+    QMutexLocker lock(&m_queueMutex);
+    return m_queueSize;
 }
 
-void VideoDataOutput::unlockCallback(void *picture, void *const*planes)
+void VideoDataOutput::setQueueSize(int size)
 {
-    Q_UNUSED(picture);
-    Q_UNUSED(planes);
-    DEBUG_BLOCK;
+    QMutexLocker lock(&m_queueMutex);
+    m_queueSize = qMax(1, size);
+    while (m_queue.size() > m_queueSize) {
+        m_queue.dequeue();
+        ++m_droppedFrames;
+    }
+    m_queueNotFull.wakeAll();
+}
+
+VideoDataOutput::OverflowPolicy VideoDataOutput::overflowPolicy() const
+{
+    QMutexLocker lock(&m_queueMutex);
+    return m_overflowPolicy;
+}
+
+void VideoDataOutput::setOverflowPolicy(OverflowPolicy policy)
+{
+    QMutexLocker lock(&m_queueMutex);
+    m_overflowPolicy = policy;
+    m_queueNotFull.wakeAll();
+}
+
+int VideoDataOutput::droppedFrames() const
+{
+    QMutexLocker lock(&m_queueMutex);
+    return m_droppedFrames;
+}
+
+QSize VideoDataOutput::targetSize() const
+{
+    QMutexLocker lock(&m_queueMutex);
+    return m_targetSize;
+}
+
+void VideoDataOutput::setTargetSize(const QSize &size)
+{
+    QMutexLocker lock(&m_queueMutex);
+    m_targetSize = size;
+}
+
+QSize VideoDataOutput::maximumSize() const
+{
+    QMutexLocker lock(&m_queueMutex);
+    return m_maximumSize;
+}
+
+void VideoDataOutput::setMaximumSize(const QSize &size)
+{
+    QMutexLocker lock(&m_queueMutex);
+    m_maximumSize = size;
+}
+
+int VideoDataOutput::frameInterval() const
+{
+    QMutexLocker lock(&m_queueMutex);
+    return m_frameInterval;
+}
+
+void VideoDataOutput::setFrameInterval(int interval)
+{
+    QMutexLocker lock(&m_queueMutex);
+    m_frameInterval = qMax(1, interval);
+}
+
+qreal VideoDataOutput::maximumFrameRate() const
+{
+    QMutexLocker lock(&m_queueMutex);
+    return m_maximumFrameRate;
+}
+
+void VideoDataOutput::setMaximumFrameRate(qreal rate)
+{
+    QMutexLocker lock(&m_queueMutex);
+    m_maximumFrameRate = qMax<qreal>(0, rate);
+}
 
-    // For some reason VLC yields BGR24, so we swap it to RGB
-    if (m_frame.format == Experimental::VideoFrame2::Format_RGB888) {
-        uchar *data = (uchar *) m_frame.data0.data();
-        uchar tmp;
-        for (int i = 0; i < m_frame.data0.size(); i += 3) {
-            tmp = data[i];
-            data[i] = data[i+2];
-            data[i+2] = tmp;
+qint64 VideoDataOutput::framePts() const
+{
+    return m_framePts.load();
+}
+
+quint64 VideoDataOutput::frameSequence() const
+{
+    return m_frameSequence.load();
+}
+
+void VideoDataOutput::clearQueue()
+{
+    QMutexLocker lock(&m_queueMutex);
+    m_queue.clear();
+    m_queueNotFull.wakeAll();
+}
+
+void VideoDataOutput::deliverFrames()
+{
+    forever {
+        m_queueMutex.lock();
+        while (m_queue.isEmpty() && !m_stopDelivery)
+            m_queueNotEmpty.wait(&m_queueMutex);
+        if (m_stopDelivery) {
+            m_queueMutex.unlock();
+            return;
         }
+        const QueuedFrame queued = m_queue.dequeue();
+        m_queueNotFull.wakeAll();
+        m_queueMutex.unlock();
+
+        QMutexLocker lock(&m_mutex);
+        m_framePts.store(queued.pts);
+        m_frameSequence.store(queued.sequence);
+        if (m_frontend)
+            m_frontend->frameReady(queued.frame);
     }
+}
 
-    if (m_frontend)
-        m_frontend->frameReady(m_frame);
+bool VideoDataOutput::wantPicture()
+{
+    m_queueMutex.lock();
+    const int interval = m_frameInterval;
+    const qreal rate = m_maximumFrameRate;
+    const qreal filterRate = m_filterRate;
+    m_queueMutex.unlock();
+
+    if (m_deliveryClock.isValid()) {
+        if (++m_framesSinceDelivery < interval)
+            return false;
+        // VLC's fps filter already keeps the rate, checking it again would
+        // drop every other frame arriving a little early.
+        if (rate > 0 && rate != filterRate
+                && m_deliveryClock.nsecsElapsed() < static_cast<qint64>(1e9 / rate))
+            return false;
+    }
+    m_framesSinceDelivery = 0;
+    m_deliveryClock.start();
+    return true;
+}
 
-    m_mutex.unlock();
+void *VideoDataOutput::lockCallback(void **planes)
+{
+    m_skipPicture = !wantPicture();
+    return lockPicture(planes);
 }
 
-void VideoDataOutput::displayCallback(void *picture)
+void VideoDataOutput::unlockCallback(void *picture, void *const*planes)
 {
-    Q_UNUSED(picture);
-    DEBUG_BLOCK;
-    // We send the frame while unlocking as we could loose syncing otherwise.
-    // With VDO the consumer is expected to ensure syncness while not blocking
-    // unlock for long periods of time. Good luck with that... -.-
+    Q_UNUSED(planes);
+    if (m_skipPicture)
+        return;
+    Picture *decoded = static_cast<Picture *>(picture);
+
+    m_queueMutex.lock();
+    const VideoFrame2::Format format = m_frame.format;
+    m_queueMutex.unlock();
+
+    // For some reason VLC yields BGR24, so we swap it to RGB.
+    // vmem has no way to ask for RV24 with other masks, so this stays.
+    if (format == VideoFrame2::Format_RGB888)
+        swapRedBlue24(reinterpret_cast<uchar *>(const_cast<char *>(decoded->plane[0].constData())),
+                      decoded->plane[0].size());
 }
 
-static VideoFrame2::Format fourccToFormat(const char *fourcc)
+void VideoDataOutput::displayCallback(void *picture)
 {
-    if (qstrcmp(fourcc, "RV24"))
-        return VideoFrame2::Format_RGB888;
-    else if (qstrcmp(fourcc, "RV32"))
-        return VideoFrame2::Format_RGB32;
-    else if (qstrcmp(fourcc, "YV12"))
-        return VideoFrame2::Format_YV12;
-    else if (qstrcmp(fourcc, "YUY2"))
-        return VideoFrame2::Format_YUY2;
-    else
-        return VideoFrame2::Format_Invalid;
+    // Only now the picture gets its timestamp, and frames VLC drops for
+    // being late never get here.
+    displayPicture(picture);
+    if (m_skipPicture)
+        return;
+    Picture *decoded = static_cast<Picture *>(picture);
+
+    // The consumer gets it from the delivery thread, so it cannot block
+    // decoding. Keeping in sync is up to the consumer, using framePts().
+    QMutexLocker lock(&m_queueMutex);
+    // The queued frame shares the picture's planes. Should VLC get back to
+    // the picture while the frame is still around, it gets fresh planes.
+    QueuedFrame queued;
+    queued.frame = m_frame;
+    queued.frame.data0 = decoded->plane[0];
+    queued.frame.data1 = decoded->plane[m_swapChroma ? 2 : 1];
+    queued.frame.data2 = decoded->plane[m_swapChroma ? 1 : 2];
+    queued.pts = decoded->pts;
+    queued.sequence = decoded->sequence;
+
+    if (m_queue.size() >= m_queueSize) {
+        switch (m_overflowPolicy) {
+        case DropOldest:
+            m_queue.dequeue();
+            ++m_droppedFrames;
+            break;
+        case DropNewest:
+            ++m_droppedFrames;
+            return;
+        case Block:
+            while (m_queue.size() >= m_queueSize && m_overflowPolicy == Block && !m_stopDelivery)
+                m_queueNotFull.wait(&m_queueMutex);
+            if (m_queue.size() >= m_queueSize) {
+                // The policy changed meanwhile.
+                m_queue.dequeue();
+                ++m_droppedFrames;
+            }
+            break;
+        }
+    }
+
+    m_queue.enqueue(queued);
+    m_queueNotEmpty.wakeOne();
 }
 
-static const vlc_chroma_description_t *setFormat(VideoFrame2::Format format, char **chroma)
+static const char *formatToFourcc(VideoFrame2::Format format)
 {
     switch (format) {
     case VideoFrame2::Format_Invalid:
-        *chroma = 0;
         return 0;
     case VideoFrame2::Format_RGB32:
-        qstrcpy(*chroma, "RV32");
-        return vlc_fourcc_GetChromaDescription(VLC_CODEC_RGB32);
+        return "RV32";
     case VideoFrame2::Format_RGB888:
-        qstrcpy(*chroma, "RV24");
-        return vlc_fourcc_GetChromaDescription(VLC_CODEC_RGB24);
+        return "RV24";
     case VideoFrame2::Format_YV12:
-        qstrcpy(*chroma, "YV12");
-        return vlc_fourcc_GetChromaDescription(VLC_CODEC_YV12);
+        return "YV12";
     case VideoFrame2::Format_YUY2:
-        qstrcpy(*chroma, "YUY2");
-        return vlc_fourcc_GetChromaDescription(VLC_CODEC_YUYV);
+        return "YUY2";
     }
     return 0;
 }
 
+/**
+ * Maps a chroma VLC can hand us as it is to a VideoFrame2 format.
+ * \param swapChroma set if the U and V planes need to trade places, which
+ *                   is what makes I420 a YV12 frame
+ */
+static VideoFrame2::Format fourccToFormat(const QByteArray &fourcc, bool *swapChroma)
+{
+    *swapChroma = false;
+    if (fourcc == "RV24")
+        return VideoFrame2::Format_RGB888;
+    if (fourcc == "RV32")
+        return VideoFrame2::Format_RGB32;
+    if (fourcc == "YV12")
+        return VideoFrame2::Format_YV12;
+    if (fourcc == "I420") {
+        *swapChroma = true;
+        return VideoFrame2::Format_YV12;
+    }
+    if (fourcc == "YUY2" || fourcc == "YUYV")
+        return VideoFrame2::Format_YUY2;
+    return VideoFrame2::Format_Invalid;
+}
+
+/**
+ * \returns the formats in the order VLC can convert \p fourcc into them
+ * most cheaply: keep the sampling and layout where possible, going from YUV
+ * to RGB is the expensive part and RV24 needs another swap on our side.
+ */
+static QList<VideoFrame2::Format> formatsByCost(const QByteArray &fourcc)
+{
+    const vlc_fourcc_t chroma = VLC_FOURCC(fourcc.at(0), fourcc.at(1), fourcc.at(2), fourcc.at(3));
+    const vlc_chroma_description_t *description = vlc_fourcc_GetChromaDescription(chroma);
+
+    QList<VideoFrame2::Format> formats;
+    if (vlc_fourcc_IsYUV(chroma) && description && description->plane_count > 1) {
+        // Planar YUV, this includes NV12 and the high bit depth variants.
+        formats << VideoFrame2::Format_YV12 << VideoFrame2::Format_YUY2
+                << VideoFrame2::Format_RGB32 << VideoFrame2::Format_RGB888;
+    } else if (vlc_fourcc_IsYUV(chroma)) {
+        // Packed YUV.
+        formats << VideoFrame2::Format_YUY2 << VideoFrame2::Format_YV12
+                << VideoFrame2::Format_RGB32 << VideoFrame2::Format_RGB888;
+    } else {
+        formats << VideoFrame2::Format_RGB32 << VideoFrame2::Format_RGB888
+                << VideoFrame2::Format_YUY2 << VideoFrame2::Format_YV12;
+    }
+    return formats;
+}
+
 unsigned VideoDataOutput::formatCallback(char *chroma,
                                          unsigned *width, unsigned *height,
                                          unsigned *pitches, unsigned *lines)
 {
     DEBUG_BLOCK;
+    QMutexLocker lock(&m_queueMutex);
+
+    // VLC scales to whatever size we put in here while converting the
+    // chroma, far cheaper than the frontend scaling afterwards.
+    QSize size(*width, *height);
+    if (m_targetSize.isValid()) {
+        size = m_targetSize;
+    } else if (m_maximumSize.isValid()
+               && (size.width() > m_maximumSize.width() || size.height() > m_maximumSize.height())) {
+        size.scale(m_maximumSize, Qt::KeepAspectRatio);
+    }
+    if (size != QSize(*width, *height)) {
+        // Subsampled chromas want even dimensions.
+        size = QSize(qMax(2, size.width() & ~1), qMax(2, size.height() & ~1));
+        debug() << "Scaling video from" << *width << "x" << *height << "to" << size;
+        *width = size.width();
+        *height = size.height();
+    }
 
     m_frame.width = *width;
     m_frame.height = *height;
 
-    const vlc_chroma_description_t *chromaDesc = 0;
-
-    QSet<VideoFrame2::Format> allowedFormats = m_frontend->allowedFormats();
-    VideoFrame2::Format suggestedFormat = fourccToFormat(chroma);
-    if (suggestedFormat != VideoFrame2::Format_Invalid
-            && allowedFormats.contains(suggestedFormat)) { // Use suggested
-        chromaDesc = setFormat(suggestedFormat, &chroma);
-        m_frame.format = suggestedFormat;
-    } else { // Pick first and use that
-        foreach (const VideoFrame2::Format &format, allowedFormats) {
-            chromaDesc = setFormat(format, &chroma);
-            if (chroma) {
-                m_frame.format = format;
+    const QSet<VideoFrame2::Format> allowedFormats = m_frontend->allowedFormats();
+    const QByteArray native(chroma, 4);
+
+    // Taking what the decoder produces saves VLC a conversion of every frame.
+    bool swapChroma;
+    VideoFrame2::Format format = fourccToFormat(native, &swapChroma);
+    QByteArray fourcc = native;
+    if (format == VideoFrame2::Format_Invalid || !allowedFormats.contains(format)) {
+        format = VideoFrame2::Format_Invalid;
+        swapChroma = false;
+        foreach (VideoFrame2::Format candidate, formatsByCost(native)) {
+            if (allowedFormats.contains(candidate)) {
+                format = candidate;
+                fourcc = formatToFourcc(candidate);
                 break;
             }
         }
     }
 
+    if (format == VideoFrame2::Format_Invalid) {
+        warning() << "The frontend accepts none of the formats we can provide";
+        return 0;
+    }
+
+    debug() << "Video chroma" << native << "->" << fourcc
+            << (fourcc == native ? "(passthrough)" : "(converted by VLC)");
+
+    qstrcpy(chroma, fourcc.constData());
+    m_frame.format = format;
+    m_swapChroma = swapChroma;
+
+    const vlc_chroma_description_t *chromaDesc =
+            vlc_fourcc_GetChromaDescription(VLC_FOURCC(chroma[0], chroma[1], chroma[2], chroma[3]));
     Q_ASSERT(chromaDesc);
 
     unsigned int bufferSize = setPitchAndLines(chromaDesc, *width, *height, pitches, lines);
 
-    m_frame.data0.resize(pitches[0] * lines[0]);
-    m_frame.data1.resize(pitches[1] * lines[1]);
-    m_frame.data2.resize(pitches[2] * lines[0]);
+    setupPictures(chromaDesc->plane_count, pitches, lines);
 
     return bufferSize;
 }
@@ -18,8 +18,13 @@
 #ifndef Phonon_VLC_VIDEODATAOUTPUT_H
 #define Phonon_VLC_VIDEODATAOUTPUT_H
 
+#include <QAtomicInteger>
+#include <QElapsedTimer>
 #include <QMutex>
 #include <QObject>
+#include <QQueue>
+#include <QSize>
+#include <QWaitCondition>
 
 #include <phonon/experimental/videodataoutputinterface.h>
 #include <phonon/experimental/videoframe2.h>
@@ -32,7 +37,13 @@ namespace Phonon
 namespace VLC
 {
 
+class FrameDeliveryThread;
+
 /**
+ * Frames are handed to the frontend from a thread of our own, through a
+ * bounded queue, so a slow consumer does not hold up VLC's decoding. What
+ * happens once the queue is full is up to overflowPolicy.
+ *
  * @author Harald Sitter <apachelogger@ubuntu.com>
  */
 class VideoDataOutput : public QObject, public SinkNode,
@@ -40,7 +51,26 @@ class VideoDataOutput : public QObject, public SinkNode,
 {
     Q_OBJECT
     Q_INTERFACES(Phonon::Experimental::VideoDataOutputInterface)
+    Q_ENUMS(OverflowPolicy)
+    Q_PROPERTY(int queueSize READ queueSize WRITE setQueueSize)
+    Q_PROPERTY(OverflowPolicy overflowPolicy READ overflowPolicy WRITE setOverflowPolicy)
+    Q_PROPERTY(int droppedFrames READ droppedFrames)
+    Q_PROPERTY(QSize targetSize READ targetSize WRITE setTargetSize)
+    Q_PROPERTY(QSize maximumSize READ maximumSize WRITE setMaximumSize)
+    Q_PROPERTY(int frameInterval READ frameInterval WRITE setFrameInterval)
+    Q_PROPERTY(qreal maximumFrameRate READ maximumFrameRate WRITE setMaximumFrameRate)
+    Q_PROPERTY(qint64 framePts READ framePts)
+    Q_PROPERTY(qulonglong frameSequence READ frameSequence)
 public:
+    enum OverflowPolicy {
+        /// Replace the oldest queued frame, the consumer sees the latest ones.
+        DropOldest,
+        /// Drop the new frame, the consumer sees an uninterrupted run first.
+        DropNewest,
+        /// Make the decoder wait, never drop anything.
+        Block
+    };
+
     explicit VideoDataOutput(QObject *parent);
     ~VideoDataOutput();
 
@@ -61,11 +91,117 @@ public:
                                     unsigned *lines);
     virtual void formatCleanUpCallback();
 
+    int queueSize() const;
+    void setQueueSize(int size);
+    OverflowPolicy overflowPolicy() const;
+    void setOverflowPolicy(OverflowPolicy policy);
+    /// \returns the number of frames dropped because the queue was full
+    int droppedFrames() const;
+
+    /**
+     * Makes VLC scale frames to \p size, in the same pass as its chroma
+     * conversion, instead of handing out frames at the source size. An
+     * invalid size (the default) keeps the source size.
+     *
+     * Takes effect the next time the video format is set up.
+     */
+    void setTargetSize(const QSize &size);
+    QSize targetSize() const;
+
+    /**
+     * Like setTargetSize(), but only scales frames down to fit into \p size,
+     * keeping their aspect ratio. Ignored while a target size is set.
+     */
+    void setMaximumSize(const QSize &size);
+    QSize maximumSize() const;
+
+    /**
+     * Only hands every \p interval-th frame to the frontend. Skipped frames
+     * are neither converted nor queued. 1 (the default) delivers all frames.
+     */
+    void setFrameInterval(int interval);
+    int frameInterval() const;
+
+    /**
+     * Hands at most \p rate frames per second to the frontend, 0 (the default)
+     * does not limit the rate. Combines with frameInterval().
+     *
+     * Low rates also make VLC drop frames before they reach us, and skip
+     * decoding frames nothing else depends on, from the next media on.
+     */
+    void setMaximumFrameRate(qreal rate);
+    qreal maximumFrameRate() const;
+
+    /**
+     * \returns the player time of the frame last handed to the frontend in
+     * microseconds, -1 if unknown. Called from within frameReady() this is the
+     * time of the frame being delivered.
+     *
+     * vmem does not pass on the picture's own timestamp, so this is the player
+     * time at which VLC displayed the frame, see MediaPlayer::estimatedTime().
+     * Between VLC's time reports, about every 250 ms, consecutive frames get
+     * increasing times. The times are good to a few milliseconds, and may
+     * jump by that much either way when a report comes in.
+     */
+    qint64 framePts() const;
+
+    /**
+     * \returns the sequence number of the frame last handed to the frontend.
+     * It increases by one with every frame VLC displays, so gaps mean frames
+     * were dropped on the way, or skipped on purpose by frameInterval() and
+     * maximumFrameRate().
+     */
+    quint64 frameSequence() const;
+
 private:
+    friend class FrameDeliveryThread;
+    /// Runs in the delivery thread until the output goes away.
+    void deliverFrames();
+    void clearQueue();
+    /// Decides from lockCallback() whether the upcoming picture goes out.
+    bool wantPicture();
+
     Experimental::AbstractVideoDataOutput *m_frontend;
+    /// Describes the pictures, their data is only filled in while handing them out.
     Experimental::VideoFrame2 m_frame;
     QByteArray m_buffer;
+    /// Held while talking to the frontend.
     QMutex m_mutex;
+
+    /// Guards the queue, its settings and m_frame. Never held for long.
+    mutable QMutex m_queueMutex;
+    QWaitCondition m_queueNotEmpty;
+    QWaitCondition m_queueNotFull;
+    struct QueuedFrame {
+        Experimental::VideoFrame2 frame;
+        qint64 pts;
+        quint64 sequence;
+    };
+    QQueue<QueuedFrame> m_queue;
+    int m_queueSize;
+    OverflowPolicy m_overflowPolicy;
+    int m_droppedFrames;
+    /// Whether the pictures are I420 and go out as YV12.
+    bool m_swapChroma;
+    QSize m_targetSize;
+    QSize m_maximumSize;
+    int m_frameInterval;
+    qreal m_maximumFrameRate;
+    /// Rate VLC's fps filter was set up with for the current media, 0 if none.
+    qreal m_filterRate;
+    bool m_stopDelivery;
+    FrameDeliveryThread *m_deliveryThread;
+
+    /// Timing of the frame handed out last, readable while the frontend holds m_mutex.
+    QAtomicInteger<qint64> m_framePts;
+    QAtomicInteger<quint64> m_frameSequence;
+
+    // Decimation state, only used by VLC's thread.
+    /// Whether the picture VLC decodes into right now gets skipped.
+    bool m_skipPicture;
+    int m_framesSinceDelivery;
+    /// Runs since the last delivered frame, invalid before the first one.
+    QElapsedTimer m_deliveryClock;
 };
 
 } // namespace VLC
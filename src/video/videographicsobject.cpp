@@ -27,7 +27,10 @@ namespace VLC {
 
 VideoGraphicsObject::VideoGraphicsObject(QObject *parent) :
     QObject(parent),
-    m_chosenFormat(VideoFrame::Format_Invalid)
+    m_picture(0),
+    m_chosenFormat(VideoFrame::Format_Invalid),
+    m_frameReadyPending(0),
+    m_coalescedFrames(0)
 {
     DEBUG_BLOCK;
     m_frame.format = VideoFrame::Format_Invalid;
@@ -60,54 +63,123 @@ void VideoGraphicsObject::disconnectFromMediaObject(MediaObject *mediaObject)
 void VideoGraphicsObject::lock()
 {
     m_mutex.lock();
+    attachPicture();
 }
 
 bool VideoGraphicsObject::tryLock()
 {
-    return m_mutex.tryLock();
+    if (!m_mutex.tryLock())
+        return false;
+    attachPicture();
+    return true;
 }
 
 void VideoGraphicsObject::unlock()
 {
+    detachPicture();
     m_mutex.unlock();
 }
 
+void VideoGraphicsObject::attachPicture()
+{
+    m_picture = acquireDisplayedPicture();
+    for (unsigned int i = 0; i < m_frame.planeCount; ++i)
+        m_frame.plane[i] = m_picture ? m_picture->plane[i] : QByteArray();
+}
+
+void VideoGraphicsObject::detachPicture()
+{
+    // Drop our references, VLC must not have to detach the planes when it
+    // gets to decode into this picture again.
+    for (unsigned int i = 0; i < m_frame.planeCount; ++i)
+        m_frame.plane[i] = QByteArray();
+    releasePicture(m_picture);
+    m_picture = 0;
+}
+
+static const char *formatToFourcc(VideoFrame::Format format)
+{
+    switch (format) {
+    case VideoFrame::Format_Invalid:
+        return 0;
+    case VideoFrame::Format_RGB32:
+        return "RV32";
+    case VideoFrame::Format_YV12:
+        return "YV12";
+    case VideoFrame::Format_I420:
+        return "I420";
+    }
+    return 0;
+}
+
+/**
+ * \returns the formats in the order VLC can convert \p fourcc into them
+ * most cheaply. Staying in YUV is always cheaper than going to RGB, painters
+ * offering YUV do that conversion on the GPU.
+ */
+static QList<VideoFrame::Format> formatsByCost(const QByteArray &fourcc)
+{
+    QList<VideoFrame::Format> formats;
+    if (fourcc == "YV12") {
+        formats << VideoFrame::Format_YV12 << VideoFrame::Format_I420 << VideoFrame::Format_RGB32;
+        return formats;
+    }
+
+    const vlc_fourcc_t chroma = VLC_FOURCC(fourcc.at(0), fourcc.at(1), fourcc.at(2), fourcc.at(3));
+    if (vlc_fourcc_IsYUV(chroma))
+        formats << VideoFrame::Format_I420 << VideoFrame::Format_YV12 << VideoFrame::Format_RGB32;
+    else
+        formats << VideoFrame::Format_RGB32 << VideoFrame::Format_I420 << VideoFrame::Format_YV12;
+    return formats;
+}
+
 QList<VideoFrame::Format> VideoGraphicsObject::offering(QList<VideoFrame::Format> offers)
 {
-    // FIXME: impl
-    return offers;
+    // Only called while formatCallback() waits for needFormat() to be
+    // handled, so m_sourceChroma is set.
+    QList<VideoFrame::Format> choices;
+    foreach (VideoFrame::Format format, formatsByCost(m_sourceChroma)) {
+        if (offers.contains(format))
+            choices.append(format);
+    }
+    return choices;
 }
 
 void VideoGraphicsObject::choose(VideoFrame::Format format)
 {
-    // FIXME: review
     m_chosenFormat = format;
 }
 
 void *VideoGraphicsObject::lockCallback(void **planes)
 {
-    lock();
-
-    for (unsigned int i = 0; i < m_frame.planeCount; ++i) {
-        planes[i] = reinterpret_cast<void *>(m_frame.plane[i].data());
-    }
-
-    return 0; // There is only one buffer, so no need to identify it.
+    // No need to lock, nobody reads from the picture we decode into.
+    return lockPicture(planes);
 }
 
 void VideoGraphicsObject::unlockCallback(void *picture, void *const*planes)
 {
     Q_UNUSED(picture);
     Q_UNUSED(planes);
-    unlock();
-    // To avoid thread polution do not call frameReady directly, but via the
-    // event loop.
-    QMetaObject::invokeMethod(this, "frameReady", Qt::QueuedConnection);
 }
 
 void VideoGraphicsObject::displayCallback(void *picture)
 {
-    Q_UNUSED(picture); // There is only one buffer.
+    displayPicture(picture);
+    // To avoid thread polution do not call frameReady directly, but via the
+    // event loop. One pending notification is enough, whoever handles it
+    // gets the latest picture anyway.
+    if (m_frameReadyPending.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "emitFrameReady", Qt::QueuedConnection);
+    else
+        m_coalescedFrames.ref();
+}
+
+void VideoGraphicsObject::emitFrameReady()
+{
+    // Cleared first, a picture displayed from now on needs a notification
+    // of its own.
+    m_frameReadyPending.store(0);
+    emit frameReady();
 }
 
 unsigned int VideoGraphicsObject::formatCallback(char *chroma,
@@ -122,37 +194,34 @@ unsigned int VideoGraphicsObject::formatCallback(char *chroma,
             << "pitches:" << *pitches
             << "lines:" << *lines;
 
-    if (m_chosenFormat == VideoFrame::Format_Invalid)
-        emit needFormat();
+    // The frontend drops its painter on reset() and may pick another one, so
+    // always ask rather than remembering an earlier painter's choice.
+    const QByteArray native(chroma, 4);
+    m_sourceChroma = native;
+    m_chosenFormat = VideoFrame::Format_Invalid;
+    emit needFormat();
+    if (m_chosenFormat == VideoFrame::Format_Invalid) {
+        // Every painter can do RGB.
+        warning() << "No format chosen, falling back to RGB32";
+        m_chosenFormat = VideoFrame::Format_RGB32;
+    }
 
-    Q_ASSERT(m_chosenFormat != VideoFrame::Format_Invalid);
+    QMutexLocker lock(&m_mutex);
 
-    const vlc_chroma_description_t *chromaDesc = 0;
-    switch(m_chosenFormat) {
-    case VideoFrame::Format_RGB32:
-        m_frame.format = VideoFrame::Format_RGB32;
-        qstrcpy(chroma, "RV32");
-        chromaDesc = vlc_fourcc_GetChromaDescription(VLC_CODEC_RGB32);
-        break;
-    case VideoFrame::Format_YV12:
-        m_frame.format = VideoFrame::Format_YV12;
-        qstrcpy(chroma, "YV12");
-        chromaDesc = vlc_fourcc_GetChromaDescription(VLC_CODEC_YV12);
-        break;
-    case VideoFrame::Format_I420:
-        m_frame.format = VideoFrame::Format_I420;
-        qstrcpy(chroma, "I420");
-        chromaDesc = vlc_fourcc_GetChromaDescription(VLC_CODEC_I420);
-        break;
-    }
+    const QByteArray fourcc = formatToFourcc(m_chosenFormat);
+    debug() << "Video chroma" << native << "->" << fourcc
+            << (fourcc == native ? "(passthrough)" : "(converted by VLC)");
+    qstrcpy(chroma, fourcc.constData());
+    m_frame.format = m_chosenFormat;
 
+    const vlc_chroma_description_t *chromaDesc =
+            vlc_fourcc_GetChromaDescription(VLC_FOURCC(chroma[0], chroma[1], chroma[2], chroma[3]));
     Q_ASSERT(chromaDesc);
 
     m_frame.width = *width;
     m_frame.height = *height;
     m_frame.planeCount = chromaDesc->plane_count;
 
-    debug() << chroma;
     const unsigned int bufferSize = setPitchAndLines(chromaDesc,
                                                      *width, *height,
                                                      pitches, lines,
@@ -160,8 +229,8 @@ unsigned int VideoGraphicsObject::formatCallback(char *chroma,
     for (unsigned int i = 0; i < m_frame.planeCount; ++i) {
         m_frame.pitch[i] = pitches[i];
         m_frame.lines[i] = lines[i];
-        m_frame.plane[i].resize(pitches[i] * lines[i]);
     }
+    setupPictures(m_frame.planeCount, pitches, lines);
     return bufferSize;
 }
 
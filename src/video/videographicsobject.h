@@ -18,6 +18,7 @@
 #ifndef PHONON_VLC_VIDEOGRAPHICSOBJECT_H
 #define PHONON_VLC_VIDEOGRAPHICSOBJECT_H
 
+#include <QtCore/QAtomicInt>
 #include <QtCore/QObject>
 #include <QtCore/QMutex>
 
@@ -41,6 +42,9 @@ class VideoGraphicsObject : public QObject,
 {
     Q_OBJECT
     Q_INTERFACES(Phonon::VideoGraphicsObjectInterface)
+    Q_PROPERTY(qint64 framePts READ framePts)
+    Q_PROPERTY(qulonglong frameSequence READ frameSequence)
+    Q_PROPERTY(int coalescedFrames READ coalescedFrames)
 public:
     explicit VideoGraphicsObject(QObject *parent = 0);
     virtual ~VideoGraphicsObject();
@@ -54,6 +58,14 @@ public:
 
     const VideoFrame *frame() const { return &m_frame; }
 
+    /// Player time of frame() in microseconds, -1 if unknown. Only valid while locked.
+    qint64 framePts() const { return m_picture ? m_picture->pts : -1; }
+    /// Sequence number of frame(), gaps mean dropped frames. Only valid while locked.
+    quint64 frameSequence() const { return m_picture ? m_picture->sequence : 0; }
+
+    /// Frames displayed while a frameReady() was still pending, so never announced on their own.
+    int coalescedFrames() const { return m_coalescedFrames.load(); }
+
     Q_INVOKABLE QList<VideoFrame::Format> offering(QList<VideoFrame::Format> offers);
     Q_INVOKABLE void choose(VideoFrame::Format format);
 
@@ -68,17 +80,33 @@ public:
     virtual void formatCleanUpCallback();
 
 signals:
+    /// A new picture was displayed, lock() to get at it through frame().
     void frameReady();
     void reset();
 
     void needFormat();
 
+private slots:
+    void emitFrameReady();
+
 protected:
+    /// Points m_frame at the latest displayed picture, m_mutex must be locked.
+    void attachPicture();
+    void detachPicture();
+
+    /// Held by whoever reads m_frame, never by VLC while decoding.
     QMutex m_mutex;
 
     Phonon::VideoFrame m_frame;
+    Picture *m_picture;
 
     Phonon::VideoFrame::Format m_chosenFormat;
+    /// Chroma the decoder suggested, offering() ranks by the cost from it.
+    QByteArray m_sourceChroma;
+
+    /// Set while a frameReady() is on its way through the event loop.
+    QAtomicInt m_frameReadyPending;
+    QAtomicInt m_coalescedFrames;
 };
 
 } // namespace VLC
@@ -18,6 +18,7 @@
 #include "videomemorystream.h"
 
 #include "mediaplayer.h"
+#include "planeallocator.h"
 
 namespace Phonon {
 namespace VLC {
@@ -27,11 +28,18 @@ static inline VideoMemoryStream *p_this(void **opaque) { return static_cast<Vide
 #define P_THIS p_this(opaque)
 
 VideoMemoryStream::VideoMemoryStream()
+    : m_displayedPicture(0)
+    , m_planeCount(0)
+    , m_sequence(0)
+    , m_timeSource(0)
 {
+    PlaneAllocator::instance()->addUser();
 }
 
 VideoMemoryStream::~VideoMemoryStream()
 {
+    clearPictures();
+    PlaneAllocator::instance()->removeUser();
 }
 
 static inline qint64 gcd(qint64 a, qint64 b)
@@ -91,8 +99,146 @@ unsigned VideoMemoryStream::setPitchAndLines(const vlc_chroma_description_t *des
     return bufferSize;
 }
 
+VideoMemoryStream::Picture *VideoMemoryStream::acquireDisplayedPicture()
+{
+    QMutexLocker lock(&m_pictureMutex);
+    Picture *picture = m_displayedPicture;
+    if (!picture && !m_pictures.isEmpty())
+        picture = m_pictures.first();
+    if (picture)
+        ++picture->users;
+    return picture;
+}
+
+void VideoMemoryStream::releasePicture(Picture *picture)
+{
+    if (!picture)
+        return;
+    QMutexLocker lock(&m_pictureMutex);
+    Q_ASSERT(picture->users > 0);
+    if (--picture->users == 0)
+        m_pictureReleased.wakeAll();
+}
+
+void VideoMemoryStream::setupPictures(unsigned planeCount, const unsigned *pitches, const unsigned *lines,
+                                      int count)
+{
+    Q_ASSERT(planeCount <= Picture::MaxPlanes);
+    QMutexLocker lock(&m_pictureMutex);
+    waitForReaders();
+    // The old planes go back to the pool first, so a format change at the
+    // same size gets them straight back.
+    deletePictures();
+    m_planeCount = planeCount;
+
+    PlaneAllocator *allocator = PlaneAllocator::instance();
+    for (int i = 0; i < count; ++i) {
+        Picture *picture = new Picture;
+        picture->users = 0;
+        picture->pts = -1;
+        picture->sequence = 0;
+        for (unsigned j = 0; j < planeCount; ++j) {
+            const int size = pitches[j] * lines[j];
+            picture->plane[j] = allocator->allocate(size);
+            memset(const_cast<char *>(picture->plane[j].constData()), 0, size);
+        }
+        m_pictures.append(picture);
+    }
+}
+
+void VideoMemoryStream::clearPictures()
+{
+    QMutexLocker lock(&m_pictureMutex);
+    waitForReaders();
+    deletePictures();
+}
+
+void VideoMemoryStream::deletePictures()
+{
+    PlaneAllocator *allocator = PlaneAllocator::instance();
+    foreach (Picture *picture, m_pictures) {
+        for (unsigned i = 0; i < m_planeCount; ++i)
+            allocator->release(picture->plane[i]);
+        delete picture;
+    }
+    m_pictures.clear();
+    m_displayedPicture = 0;
+}
+
+VideoMemoryStream::Picture *VideoMemoryStream::lockPicture(void **planes)
+{
+    QMutexLocker lock(&m_pictureMutex);
+    Q_ASSERT(!m_pictures.isEmpty());
+
+    // vmem only ever has one picture in flight, so anything that is neither
+    // displayed nor read from is ours.
+    Picture *free = 0;
+    forever {
+        foreach (Picture *picture, m_pictures) {
+            if (picture != m_displayedPicture && picture->users == 0) {
+                free = picture;
+                break;
+            }
+        }
+        if (free)
+            break;
+        // Only happens with a tiny pool or a reader holding on to an old
+        // picture after another one got displayed.
+        m_pictureReleased.wait(&m_pictureMutex);
+    }
+
+    PlaneAllocator *allocator = PlaneAllocator::instance();
+    for (unsigned i = 0; i < m_planeCount; ++i) {
+        QByteArray &plane = free->plane[i];
+        // Someone still holds a copy of the last frame in here. Detaching
+        // would copy data VLC overwrites anyway, just start afresh. The old
+        // buffer returns to the pool once that copy is gone.
+        if (!plane.isDetached()) {
+            const int size = plane.size();
+            allocator->release(plane);
+            plane = allocator->allocate(size);
+        }
+        planes[i] = const_cast<char *>(plane.constData());
+    }
+    return free;
+}
+
+void VideoMemoryStream::displayPicture(void *picture)
+{
+    // vmem does not tell us the picture's own pts, the player time is the
+    // closest thing to it. Only the time estimated from player events may be
+    // used here, libvlc_media_player_get_time() can deadlock against a stop
+    // joining this thread.
+    const qint64 time = m_timeSource ? m_timeSource->estimatedTime() : -1;
+
+    QMutexLocker lock(&m_pictureMutex);
+    Picture *displayed = static_cast<Picture *>(picture);
+    if (displayed && m_pictures.contains(displayed)) {
+        displayed->pts = time;
+        displayed->sequence = ++m_sequence;
+        m_displayedPicture = displayed;
+    }
+}
+
+void VideoMemoryStream::waitForReaders()
+{
+    forever {
+        bool used = false;
+        foreach (Picture *picture, m_pictures) {
+            if (picture->users) {
+                used = true;
+                break;
+            }
+        }
+        if (!used)
+            return;
+        m_pictureReleased.wait(&m_pictureMutex);
+    }
+}
+
 void VideoMemoryStream::setCallbacks(MediaPlayer *player)
 {
+    m_timeSource = player;
     libvlc_video_set_callbacks(player->libvlc_media_player(),
                                lockCallbackInternal,
                                unlockCallbackInternal,
@@ -113,6 +259,7 @@ void VideoMemoryStream::unsetCallbacks(MediaPlayer *player)
     libvlc_video_set_format_callbacks(player->libvlc_media_player(),
                                       0,
                                       0);
+    m_timeSource = 0;
 }
 
 
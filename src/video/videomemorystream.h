@@ -18,6 +18,11 @@
 #ifndef PHONON_VLC_VIDEOMEMORYSTREAM_H
 #define PHONON_VLC_VIDEOMEMORYSTREAM_H
 
+#include <QtCore/QByteArray>
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
+#include <QtCore/QWaitCondition>
+
 #include <vlc/plugins/vlc_fourcc.h>
 
 namespace Phonon {
@@ -42,7 +47,56 @@ public:
     void setCallbacks(Phonon::VLC::MediaPlayer *player);
     void unsetCallbacks(Phonon::VLC::MediaPlayer *player);
 
+    /** \brief One set of planes VLC decodes a frame into
+     *
+     * Pictures come from a small pool set up by setupPictures(), so that VLC
+     * can decode the next frame while the last displayed one is being read.
+     * Their planes come from the PlaneAllocator, so write to them through
+     * constData() rather than data().
+     */
+    struct Picture {
+        enum { MaxPlanes = 4 };
+        QByteArray plane[MaxPlanes];
+        /// Readers holding the picture through acquireDisplayedPicture().
+        int users;
+        /// Player time when the picture was displayed in microseconds, -1 if unknown.
+        qint64 pts;
+        /// Increases by one with every displayed picture, 0 if never displayed.
+        quint64 sequence;
+    };
+
+    /**
+     * Consumer side. Keeps the most recently displayed picture from being
+     * decoded into until releasePicture() is called. Before the first frame
+     * was displayed this is the (blank) first picture.
+     *
+     * \returns the picture, or 0 if no pictures are set up
+     */
+    Picture *acquireDisplayedPicture();
+    void releasePicture(Picture *picture);
+
 protected:
+    /**
+     * (Re)creates the picture pool for the given plane layout, usually from
+     * formatCallback(). Blocks until readers released their pictures.
+     */
+    void setupPictures(unsigned planeCount, const unsigned *pitches, const unsigned *lines,
+                       int count = 3);
+    /// Drops all pictures once readers released them.
+    void clearPictures();
+
+    /**
+     * For lockCallback(): picks a picture nobody reads from and fills in
+     * \p planes. The result is the picture id to return to VLC.
+     */
+    Picture *lockPicture(void **planes);
+
+    /**
+     * For displayCallback(): makes \p picture the latest displayed one and
+     * stamps it with the current player time and the next sequence number.
+     */
+    void displayPicture(void *picture);
+
     virtual void *lockCallback(void **planes) = 0;
     virtual void unlockCallback(void *picture,void *const *planes) = 0;
     virtual void displayCallback(void *picture) = 0;
@@ -64,6 +118,19 @@ private:
                                            unsigned *lines);
     static void formatCleanUpCallbackInternal(void *opaque);
 
+    /// Waits until no picture has users, m_pictureMutex must be locked.
+    void waitForReaders();
+    /// Hands all planes back to the allocator, m_pictureMutex must be locked.
+    void deletePictures();
+
+    QMutex m_pictureMutex;
+    QWaitCondition m_pictureReleased;
+    QVector<Picture *> m_pictures;
+    Picture *m_displayedPicture;
+    unsigned m_planeCount;
+    quint64 m_sequence;
+    /// Player the callbacks are set on, its time stamps displayed pictures.
+    MediaPlayer *m_timeSource;
 };
 
 } // namespace VLC
@@ -21,8 +21,11 @@
 
 #include "videowidget.h"
 
+#include <QtGui/QGuiApplication>
 #include <QtGui/QPainter>
 #include <QtGui/QPaintEvent>
+#include <QtGui/QScreen>
+#include <QtGui/QWindow>
 
 #include <vlc/vlc.h>
 
@@ -30,22 +33,44 @@
 #include "mediaobject.h"
 #include "media.h"
 
+#include "video/bilinearscale.h"
 #include "video/videomemorystream.h"
 
 namespace Phonon {
 namespace VLC {
 
 #define DEFAULT_QSIZE QSize(320, 240)
+// Time in milliseconds a resize must have settled before the crop follows it.
+#define RESIZEDELAY 250
 
 class SurfacePainter : public VideoMemoryStream
 {
 public:
+    SurfacePainter()
+        : widget(0)
+        , paintedPts(-1)
+        , paintedSequence(0)
+        , paintPending(0)
+        , m_bytesPerLine(0)
+        , m_aspectRatio(Phonon::VideoWidget::AspectRatioAuto)
+        , m_scaleMode(Phonon::VideoWidget::FitInView)
+        , m_scaledSequence(0)
+    {
+    }
+
     void handlePaint(QPaintEvent *event)
     {
-        // Mind that locking here is still faster than making this lockfree by
-        // dispatching QEvents.
-        // Plus VLC can actually skip frames as necessary.
-        QMutexLocker lock(&m_mutex);
+        // VLC decodes into another picture of the pool meanwhile, so we only
+        // keep it from reusing the one we paint. m_mutex merely keeps the
+        // picture and its description consistent.
+        m_mutex.lock();
+        Picture *picture = acquireDisplayedPicture();
+        const QSize frameSize = m_frameSize;
+        const int bytesPerLine = m_bytesPerLine;
+        const QRect targetRect = drawFrameRect(widget->size());
+        m_mutex.unlock();
+        if (!picture)
+            return;
         Q_UNUSED(event);
         QPainter painter(widget);
         // When using OpenGL for the QPaintEngine drawing the same QImage twice
@@ -53,35 +78,94 @@ public:
         // So we simply create new iamges for every event. This is plenty cheap
         // as the QImage only points to the plane data (it can't even make it
         // properly shared as it does not know that the data belongs to a QBA).
-        painter.drawImage(drawFrameRect(),
-                          QImage(reinterpret_cast<const uchar *>(m_plane.constData()),
-                                 m_frame.width(), m_frame.height(),
-                                 m_frame.bytesPerLine(), m_frame.format()));
+        const QImage frame(reinterpret_cast<const uchar *>(picture->plane[0].constData()),
+                           frameSize.width(), frameSize.height(),
+                           bytesPerLine, QImage::Format_RGB32);
+
+        // In ScaleAndCrop the frame overflows the widget. vmem always hands
+        // us the whole picture, so we crop here: only the part of the frame
+        // inside the widget gets scaled and painted.
+        const QRect visibleRect = targetRect & widget->rect();
+        const QRect sourceRect = frameSourceRect(frame.rect(), targetRect, visibleRect);
+        if (visibleRect.isEmpty() || sourceRect.isEmpty()) {
+            releasePicture(picture);
+            return;
+        }
+
+        // Frames come at the source size. Scale them down ourselves, once
+        // per frame rather than once per paint, QPainter only scales up.
+        const QSize deviceSize = visibleRect.size() * widget->devicePixelRatio();
+        if (sourceRect.width() > deviceSize.width() && sourceRect.height() > deviceSize.height()) {
+            if (m_scaled.size() != deviceSize || m_scaledSource != sourceRect
+                    || m_scaledSequence != picture->sequence) {
+                if (m_scaled.size() != deviceSize)
+                    m_scaled = QImage(deviceSize, QImage::Format_RGB32);
+                const uchar *source = frame.constBits() + sourceRect.y() * frame.bytesPerLine()
+                        + sourceRect.x() * 4;
+                scaleBilinear32(source, sourceRect.width(), sourceRect.height(), frame.bytesPerLine(),
+                                m_scaled.bits(), m_scaled.width(), m_scaled.height(), m_scaled.bytesPerLine());
+                m_scaledSource = sourceRect;
+                m_scaledSequence = picture->sequence;
+            }
+            painter.drawImage(visibleRect, m_scaled);
+        } else {
+            m_scaled = QImage();
+            painter.drawImage(visibleRect, frame, sourceRect);
+        }
+
+        paintedPts = picture->pts;
+        paintedSequence = picture->sequence;
+        releasePicture(picture);
         event->accept();
     }
 
+    /**
+     * How frames get fitted into the widget. Copied rather than asked from
+     * the widget, which VLC's thread must not touch.
+     */
+    void setPaintModes(Phonon::VideoWidget::AspectRatio aspectRatio,
+                       Phonon::VideoWidget::ScaleMode scaleMode)
+    {
+        QMutexLocker lock(&m_mutex);
+        m_aspectRatio = aspectRatio;
+        m_scaleMode = scaleMode;
+    }
+
+    /// Lets the painter delete itself once VLC is done with it.
+    void detach()
+    {
+        QMutexLocker lock(&m_mutex);
+        widget = 0;
+    }
+
+    /// Only changed under m_mutex, which VLC's thread has to hold to read it.
     VideoWidget *widget;
+    /// Timing of the picture painted last, only touched by the GUI thread.
+    qint64 paintedPts;
+    quint64 paintedSequence;
+    /// Set while the widget has yet to take care of a displayed frame.
+    QAtomicInt paintPending;
 
 private:
     virtual void *lockCallback(void **planes)
     {
-        m_mutex.lock();
-        planes[0] = (void *) m_plane.data();
-        return 0;
+        return lockPicture(planes);
     }
 
     virtual void unlockCallback(void *picture,void *const *planes)
     {
         Q_UNUSED(picture);
         Q_UNUSED(planes);
-        m_mutex.unlock();
     }
 
     virtual void displayCallback(void *picture)
     {
-        Q_UNUSED(picture);
-        if (widget)
-            widget->update();
+        displayPicture(picture);
+        // Frames arriving while one is pending are simply painted together
+        // with it, the widget always paints the latest picture.
+        QMutexLocker lock(&m_mutex);
+        if (widget && paintPending.testAndSetOrdered(0, 1))
+            QMetaObject::invokeMethod(widget, "scheduleFramePaint", Qt::QueuedConnection);
     }
 
     virtual unsigned formatCallback(char *chroma,
@@ -89,20 +173,28 @@ private:
                                     unsigned *pitches,
                                     unsigned *lines)
     {
+        // Frames keep the source size. libVLC cannot renegotiate the format
+        // of a running vmem output, so frames sized for the widget now would
+        // stay that small after it grows, e.g. going fullscreen.
+        // handlePaint() scales them down instead.
+        QMutexLocker lock(&m_mutex);
         qstrcpy(chroma, "RV32");
         unsigned bufferSize = setPitchAndLines(vlc_fourcc_GetChromaDescription(VLC_CODEC_RGB32),
                                                *width, *height,
                                                pitches, lines);
-        m_plane.resize(bufferSize);
-        m_frame = QImage(reinterpret_cast<const uchar *>(m_plane.constData()),
-                         *width, *height, pitches[0], QImage::Format_RGB32);
+        setupPictures(1, pitches, lines);
+        m_frameSize = QSize(*width, *height);
+        m_bytesPerLine = pitches[0];
         return bufferSize;
     }
 
     virtual void formatCleanUpCallback()
     {
         // Lazy delete the object to avoid callbacks from VLC after deletion.
-        if (!widget)
+        m_mutex.lock();
+        const bool detached = !widget;
+        m_mutex.unlock();
+        if (detached)
             delete this;
     }
 
@@ -117,11 +209,31 @@ private:
         return QRect(0, 0, (int)width, (int)height);
     }
 
-    QRect drawFrameRect() const
+    /**
+     * \returns the part of a frame of \p frameRect that ends up in
+     * \p visibleRect when the whole frame is drawn to \p targetRect.
+     */
+    static QRect frameSourceRect(const QRect &frameRect, const QRect &targetRect, const QRect &visibleRect)
     {
-        QRect widgetRect = widget->rect();
+        if (visibleRect == targetRect)
+            return frameRect;
+        if (visibleRect.isEmpty())
+            return QRect();
+        const qreal xScale = qreal(frameRect.width()) / targetRect.width();
+        const qreal yScale = qreal(frameRect.height()) / targetRect.height();
+        const QRectF source((visibleRect.x() - targetRect.x()) * xScale,
+                            (visibleRect.y() - targetRect.y()) * yScale,
+                            visibleRect.width() * xScale,
+                            visibleRect.height() * yScale);
+        return source.toAlignedRect() & frameRect;
+    }
+
+    /// m_mutex must be locked.
+    QRect drawFrameRect(const QSize &widgetSize) const
+    {
+        QRect widgetRect(QPoint(0, 0), widgetSize);
         QRect drawFrameRect;
-        switch (widget->aspectRatio()) {
+        switch (m_aspectRatio) {
         case Phonon::VideoWidget::AspectRatioWidget:
             drawFrameRect = widgetRect;
             // No more calculations needed.
@@ -133,7 +245,7 @@ private:
             drawFrameRect = scaleToAspect(widgetRect, 16, 9);
             break;
         case Phonon::VideoWidget::AspectRatioAuto:
-            drawFrameRect = QRect(0, 0, m_frame.width(), m_frame.height());
+            drawFrameRect = QRect(QPoint(0, 0), m_frameSize);
             break;
         }
 
@@ -144,7 +256,7 @@ private:
         float frameWidth = widgetWidth;
         float frameHeight = drawFrameRect.height() * float(widgetWidth) / float(drawFrameRect.width());
 
-        switch (widget->scaleMode()) {
+        switch (m_scaleMode) {
         case Phonon::VideoWidget::ScaleAndCrop:
             if (frameHeight < widgetHeight) {
                 frameWidth *= float(widgetHeight) / float(frameHeight);
@@ -164,10 +276,19 @@ private:
         return drawFrameRect;
     }
 
-    QImage m_frame;
-    // We need an idependent plane as QImage needs to be forced to use the right stride/pitch.
-    QByteArray m_plane;
+    // The frame's data is in the pictures, these describe them. We paint
+    // through a QImage as it can be forced to use the right stride/pitch.
+    QSize m_frameSize;
+    int m_bytesPerLine;
+    Phonon::VideoWidget::AspectRatio m_aspectRatio;
+    Phonon::VideoWidget::ScaleMode m_scaleMode;
     QMutex m_mutex;
+
+    /// Frame scaled by handlePaint(), only touched by the GUI thread.
+    QImage m_scaled;
+    /// Part of the frame m_scaled was scaled from.
+    QRect m_scaledSource;
+    quint64 m_scaledSequence;
 };
 
 VideoWidget::VideoWidget(QWidget *parent) :
@@ -181,7 +302,8 @@ VideoWidget::VideoWidget(QWidget *parent) :
     m_contrast(0.0),
     m_hue(0.0),
     m_saturation(0.0),
-    m_surfacePainter(0)
+    m_surfacePainter(0),
+    m_maximumRepaintRate(0)
 {
     // We want background painting so Qt autofills with black.
     setAttribute(Qt::WA_NoSystemBackground, false);
@@ -197,12 +319,20 @@ VideoWidget::VideoWidget(QWidget *parent) :
     p.setColor(backgroundRole(), Qt::black);
     setPalette(p);
     setAutoFillBackground(true);
+
+    m_framePaintTimer.setSingleShot(true);
+    m_framePaintTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_framePaintTimer, SIGNAL(timeout()), SLOT(paintLatestFrame()));
+
+    m_resizeTimer.setSingleShot(true);
+    m_resizeTimer.setInterval(RESIZEDELAY);
+    connect(&m_resizeTimer, SIGNAL(timeout()), SLOT(updateCropGeometry()));
 }
 
 VideoWidget::~VideoWidget()
 {
     if (m_surfacePainter)
-        m_surfacePainter->widget = 0; // Lazy delete
+        m_surfacePainter->detach(); // Lazy delete
 }
 
 void VideoWidget::handleConnectToMediaObject(MediaObject *mediaObject)
@@ -215,6 +345,7 @@ void VideoWidget::handleConnectToMediaObject(MediaObject *mediaObject)
             SLOT(clearPendingAdjusts()));
 
     clearPendingAdjusts();
+    setScaleMode(m_scaleMode);
 }
 
 void VideoWidget::handleDisconnectFromMediaObject(MediaObject *mediaObject)
@@ -239,6 +370,64 @@ void VideoWidget::handleAddToMedia(Media *media)
     }
 }
 
+qint64 VideoWidget::framePts() const
+{
+    return m_surfacePainter ? m_surfacePainter->paintedPts : -1;
+}
+
+quint64 VideoWidget::frameSequence() const
+{
+    return m_surfacePainter ? m_surfacePainter->paintedSequence : 0;
+}
+
+qreal VideoWidget::maximumRepaintRate() const
+{
+    return m_maximumRepaintRate;
+}
+
+void VideoWidget::setMaximumRepaintRate(qreal rate)
+{
+    m_maximumRepaintRate = qMax<qreal>(0, rate);
+}
+
+void VideoWidget::scheduleFramePaint()
+{
+    qreal rate = m_maximumRepaintRate;
+    if (rate <= 0) {
+        const QWindow *handle = window()->windowHandle();
+        const QScreen *screen = handle ? handle->screen() : QGuiApplication::primaryScreen();
+        rate = screen ? screen->refreshRate() : 0;
+    }
+    if (rate <= 0)
+        rate = 60;
+
+    const qint64 interval = static_cast<qint64>(1000 / rate);
+    const qint64 elapsed = m_framePaintClock.isValid() ? m_framePaintClock.elapsed() : interval;
+    if (elapsed < interval) {
+        // Still pending, so further frames do not post anything meanwhile.
+        if (!m_framePaintTimer.isActive())
+            m_framePaintTimer.start(interval - elapsed);
+        return;
+    }
+    paintLatestFrame();
+}
+
+void VideoWidget::paintLatestFrame()
+{
+    if (!m_surfacePainter)
+        return;
+    m_surfacePainter->paintPending.store(0);
+
+    // Nobody sees frames of a hidden or minimized window. Should someone
+    // render() us anyway, handlePaint() picks up the latest picture.
+    // Off-screen windows (graphics view proxies) cannot be told apart from
+    // visible ones, so they keep getting painted.
+    if (!isVisible() || window()->isMinimized())
+        return;
+    m_framePaintClock.start();
+    update();
+}
+
 Phonon::VideoWidget::AspectRatio VideoWidget::aspectRatio() const
 {
     return m_aspectRatio;
@@ -251,6 +440,8 @@ void VideoWidget::setAspectRatio(Phonon::VideoWidget::AspectRatio aspect)
         return;
 
     m_aspectRatio = aspect;
+    if (m_surfacePainter)
+        m_surfacePainter->setPaintModes(m_aspectRatio, m_scaleMode);
 
     switch (m_aspectRatio) {
     // FIXME: find a way to implement aspectratiowidget, it is meant to scale
@@ -275,15 +466,53 @@ Phonon::VideoWidget::ScaleMode VideoWidget::scaleMode() const
 
 void VideoWidget::setScaleMode(Phonon::VideoWidget::ScaleMode scale)
 {
-#ifdef __GNUC__
-#warning OMG WTF
-#endif
+    DEBUG_BLOCK;
     m_scaleMode = scale;
+    if (m_surfacePainter)
+        m_surfacePainter->setPaintModes(m_aspectRatio, m_scaleMode);
+    if (!m_player)
+        return;
+
     switch (m_scaleMode) {
+    case Phonon::VideoWidget::FitInView:
+        m_player->setVideoCropGeometry(QByteArray());
+        m_player->setVideoScale(0);
+        return;
+    case Phonon::VideoWidget::ScaleAndCrop:
+        // A native video output crops to the widget's shape when displaying,
+        // the picture is still decoded and converted whole. Fitting what is
+        // left into the window then fills it exactly.
+        m_player->setVideoCropGeometry(cropGeometry());
+        m_player->setVideoScale(0);
+        return;
     }
     warning() << "The scale mode" << scale << "is not supported by Phonon VLC.";
 }
 
+static int greatestCommonDivisor(int a, int b)
+{
+    while (b) {
+        const int rest = a % b;
+        a = b;
+        b = rest;
+    }
+    return a;
+}
+
+QByteArray VideoWidget::cropGeometry() const
+{
+    // vmem ignores the crop and hands us whole pictures, the surface painter
+    // crops when painting instead.
+    if (m_surfacePainter)
+        return QByteArray();
+    const QSize widgetSize = size();
+    if (widgetSize.isEmpty())
+        return QByteArray();
+    const int divisor = greatestCommonDivisor(widgetSize.width(), widgetSize.height());
+    return QByteArray::number(widgetSize.width() / divisor) + ':'
+            + QByteArray::number(widgetSize.height() / divisor);
+}
+
 qreal VideoWidget::brightness() const
 {
     return m_brightness;
@@ -415,11 +644,21 @@ void VideoWidget::setVisible(bool visible)
         debug() << "SURFACE PAINTING";
         m_surfacePainter = new SurfacePainter;
         m_surfacePainter->widget = this;
+        m_surfacePainter->setPaintModes(m_aspectRatio, m_scaleMode);
         m_surfacePainter->setCallbacks(m_player);
+        // Drops a crop set for native output.
+        setScaleMode(m_scaleMode);
     }
     QWidget::setVisible(visible);
 }
 
+void VideoWidget::updateCropGeometry()
+{
+    // The crop follows the widget's shape.
+    if (m_player && m_scaleMode == Phonon::VideoWidget::ScaleAndCrop)
+        m_player->setVideoCropGeometry(cropGeometry());
+}
+
 void VideoWidget::processPendingAdjusts(bool videoAvailable)
 {
     if (!videoAvailable || !m_mediaObject || !m_mediaObject->hasVideo()) {
@@ -439,6 +678,13 @@ void VideoWidget::clearPendingAdjusts()
     m_pendingAdjusts.clear();
 }
 
+void VideoWidget::resizeEvent(QResizeEvent *event)
+{
+    BaseWidget::resizeEvent(event);
+    if (!m_surfacePainter && m_scaleMode == Phonon::VideoWidget::ScaleAndCrop)
+        m_resizeTimer.start();
+}
+
 void VideoWidget::paintEvent(QPaintEvent *event)
 {
     Q_UNUSED(event);
@@ -22,6 +22,8 @@
 #ifndef PHONON_VLC_VIDEOWIDGET_H
 #define PHONON_VLC_VIDEOWIDGET_H
 
+#include <QElapsedTimer>
+#include <QTimer>
 #include <QWidget>
 
 #include <phonon/videowidgetinterface.h>
@@ -50,6 +52,9 @@ class VideoWidget : public BaseWidget, public SinkNode, public VideoWidgetInterf
 {
     Q_OBJECT
     Q_INTERFACES(Phonon::VideoWidgetInterface44)
+    Q_PROPERTY(qint64 framePts READ framePts)
+    Q_PROPERTY(qulonglong frameSequence READ frameSequence)
+    Q_PROPERTY(qreal maximumRepaintRate READ maximumRepaintRate WRITE setMaximumRepaintRate)
 public:
     /**
      * Constructs a new VideoWidget with the given parent. The video settings members
@@ -81,6 +86,26 @@ public:
     /** \reimp */
     void handleAddToMedia(Media *media);
 
+    /**
+     * \returns the player time of the frame painted last in microseconds, or
+     * -1 if unknown. Only known when we paint frames ourselves rather than
+     * VLC drawing into the window.
+     */
+    qint64 framePts() const;
+
+    /**
+     * \returns the sequence number of the frame painted last, 0 if unknown.
+     * \see framePts()
+     */
+    quint64 frameSequence() const;
+
+    /**
+     * Caps how often per second new frames get painted when we paint them
+     * ourselves. 0 (the default) uses the refresh rate of the screen.
+     */
+    void setMaximumRepaintRate(qreal rate);
+    qreal maximumRepaintRate() const;
+
     /**
      * \return The aspect ratio previously set for the video widget
      */
@@ -174,9 +199,18 @@ private slots:
      */
     void clearPendingAdjusts();
 
+    /// Posted by the surface painter when a new frame is there to be painted.
+    void scheduleFramePaint();
+    void paintLatestFrame();
+
+    /// Adapts the crop of ScaleAndCrop once resizing settled.
+    void updateCropGeometry();
+
 protected:
     /// \reimp
     void paintEvent(QPaintEvent *event);
+    /// \reimp
+    void resizeEvent(QResizeEvent *event);
 
 private:
     /**
@@ -192,6 +226,9 @@ private:
      */
     bool enableFilterAdjust(bool adjust = true);
 
+    /// \returns the VLC crop ratio matching the widget's shape, empty when it has none or we paint frames ourselves
+    QByteArray cropGeometry() const;
+
     /**
      * Converts a Phonon range to a VLC value range.
      *
@@ -240,6 +277,12 @@ private:
     qreal m_saturation;
 
     SurfacePainter *m_surfacePainter;
+
+    qreal m_maximumRepaintRate;
+    /// Runs since the last frame paint was requested.
+    QElapsedTimer m_framePaintClock;
+    QTimer m_framePaintTimer;
+    QTimer m_resizeTimer;
 };
 
 } // namespace VLC